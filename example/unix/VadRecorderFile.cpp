@@ -0,0 +1,162 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include "wavreader.h"
+#include "VadRecorder.hpp"
+#include "logger.h"
+
+#define TAG "VadRecorderFile"
+
+class VadRecorderListenerFile : public VadRecorderListener
+{
+public:
+    VadRecorderListenerFile(FILE *voiceFile, FILE *timestampFile)
+      : mVoiceFile(voiceFile), mTimestampFile(timestampFile), mVoiceBytes(0) {}
+    ~VadRecorderListenerFile() {}
+    void onOutputBufferAvailable(char *outBuffer, int outLength) {
+        fwrite(outBuffer, outLength, 1, mVoiceFile);
+        mVoiceBytes += outLength;
+    }
+    void onSpeechBegin() { updateTimestampFile("Speech Begin"); }
+    void onSpeechEnd() { updateTimestampFile("Speech End"); }
+    void onMarginBegin() { updateTimestampFile("Margin Begin"); }
+    void onMarginEnd() { updateTimestampFile("Margin End"); }
+private:
+    FILE *mVoiceFile;
+    FILE *mTimestampFile;
+    long mVoiceBytes;
+    // Offline events are stamped with the position in the aac output
+    void updateTimestampFile(const char *event) {
+        if (mTimestampFile != NULL)
+            fprintf(mTimestampFile, "%10ld [%s]\n", mVoiceBytes, event);
+    }
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "%s [-t threads] [-m margin_ms] [-f frame_ms] [-g guard_ms] [-e gate_db] [-a] in.wav out.aac [timestamp.txt]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    int threadCount = 0;
+    int marginMs = 0;
+    int frameTimeMs = 10;
+    int guardMs = -1;
+    int gateDb = 0;
+    bool adaptiveEos = false;
+    int ch;
+    while ((ch = getopt(argc, argv, "t:m:f:g:e:a")) != -1) {
+        switch (ch) {
+        case 't':
+            threadCount = atoi(optarg);
+            break;
+        case 'm':
+            marginMs = atoi(optarg);
+            break;
+        case 'f':
+            frameTimeMs = atoi(optarg);
+            break;
+        case 'g':
+            guardMs = atoi(optarg);
+            break;
+        case 'e':
+            gateDb = atoi(optarg);
+            break;
+        case 'a':
+            adaptiveEos = true;
+            break;
+        case '?':
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *inFileName = argv[optind];
+    const char *voiceFileName = argv[optind + 1];
+    const char *timestampFileName = argc - optind > 2 ? argv[optind + 2] : NULL;
+
+    // Check the header before mapping the whole file
+    int format, channels, sampleRate, bitsPerSample;
+    unsigned int dataLength;
+    void *wav = wav_read_open(inFileName);
+    if (wav == NULL) {
+        pr_err("Unable to open wav file %s", inFileName);
+        return 1;
+    }
+    if (!wav_get_header(wav, &format, &channels, &sampleRate, &bitsPerSample, &dataLength)) {
+        pr_err("Bad wav file %s", inFileName);
+        wav_read_close(wav);
+        return 1;
+    }
+    wav_read_close(wav);
+    // pcm, float or extensible, sample depth is checked by processFile()
+    if (format != 1 && format != 3 && format != 0xFFFE) {
+        pr_err("Unsupported wav format %d, sample depth %d", format, bitsPerSample);
+        return 1;
+    }
+    pr_dbg("Input %s: %dHz/%dCh/%dBits, %u bytes", inFileName, sampleRate, channels, bitsPerSample, dataLength);
+
+    FILE *voiceFile = fopen(voiceFileName, "wb");
+    if (voiceFile == NULL) {
+        pr_err("Failed to open output aac file: %s", voiceFileName);
+        return 1;
+    }
+    FILE *timestampFile = NULL;
+    if (timestampFileName != NULL) {
+        timestampFile = fopen(timestampFileName, "w");
+        if (timestampFile == NULL) {
+            pr_err("Failed to open output timestamp file: %s", timestampFileName);
+            fclose(voiceFile);
+            return 1;
+        }
+    }
+
+    VadRecorder vadRecorder;
+    VadRecorderListenerFile vadRecorderListener(voiceFile, timestampFile);
+    if (marginMs > 0)
+        vadRecorder.setSpeechMarginMs(marginMs);
+    vadRecorder.setVadFrameTimeMs(frameTimeMs);
+    vadRecorder.setPrerollGuardMs(guardMs);
+    vadRecorder.setEnergyGateDb(gateDb);
+    vadRecorder.setAdaptiveEos(adaptiveEos);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ret = vadRecorder.processFile(&vadRecorderListener, inFileName, threadCount);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    double duration = (double)dataLength/(sampleRate*channels*bitsPerSample/8);
+    if (ret)
+        pr_wrn("Processed %.1fs of audio in %.2fs (%.1fx real time)",
+               duration, elapsed, elapsed > 0 ? duration/elapsed : 0);
+    else
+        pr_err("Failed to process %s", inFileName);
+
+    fclose(voiceFile);
+    if (timestampFile != NULL)
+        fclose(timestampFile);
+    return ret ? 0 : 1;
+}
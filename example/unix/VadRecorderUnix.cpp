@@ -103,6 +103,8 @@ int main(int argc, char *argv[])
     VadRecorderListener *vadRecorderListener =
             new VadRecorderListenerUnix(voiceFile, timestampFile);
     vadRecorder->setSpeechMarginMs(SPEECH_MARGIN);
+    // keep aac encoding out of the PortAudio callback
+    vadRecorder->setAsyncEncode(true);
     if (!vadRecorder->init(vadRecorderListener, SAMPLE_RATE, CHANNEL_COUNT, SAMPLE_BITS)) {
         pr_err("Failed to init VadRecorder");
         goto __out;
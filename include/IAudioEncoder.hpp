@@ -48,6 +48,14 @@ public:
         ENCODER_ERROR_EOF           = -17,
     };
 
+    // Layout of input pcm samples
+    enum SampleFormat {
+        SAMPLE_FORMAT_S16 = 0,      // 16-bit signed
+        SAMPLE_FORMAT_S24_3LE,      // 24-bit signed, packed in 3 bytes, little endian
+        SAMPLE_FORMAT_S32,          // 32-bit signed
+        SAMPLE_FORMAT_F32,          // 32-bit float, full scale is [-1.0, 1.0]
+    };
+
     virtual ~IAudioEncoder() {}
 
     /**
@@ -56,10 +64,12 @@ public:
      * \param sampleRate [IN] pcm sample rate.
      * \param channels [IN] number of channels on input (1,2).
      * \param bits [IN] pcm bits per sample.
+     * \param sampleFormat [IN] pcm sample format, bits must match it (16/24/32/32).
      * \retval ENCODER_NOERROR Succeeded. Others Failed.
      */
     virtual int init(IAudioEncoderListener *listener,
-                     int sampleRate, int channels, int bitsPerSample) = 0;
+                     int sampleRate, int channels, int bitsPerSample,
+                     SampleFormat sampleFormat = SAMPLE_FORMAT_S16) = 0;
 
     /**
      * Feed pcm data.
@@ -69,6 +79,12 @@ public:
      */
     virtual int encode(char *inBuffer, int inLength) = 0;
 
+    /**
+     * Get output bitrate, valid after init.
+     * \retval bitrate in bps.
+     */
+    virtual int getBitRate() = 0;
+
     /**
      * Uninit audio encoder.
      * \retval N/A.
@@ -16,11 +16,38 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include "IAudioEncoder.hpp"
 
 #ifndef __VADRECORDER_H
 #define __VADRECORDER_H
 
+class AdtsFrameCache;
+struct VadRecorderCounters;
+namespace webrtc { class Resampler; }
+
+// Runtime statistics of a recorder, cumulative since init(). Times are cpu
+// time of the threads doing the work.
+struct VadRecorderStats {
+    uint64_t framesProcessed;       // VAD frames
+    uint64_t speechFrames;          // frames within speech
+    uint64_t silenceFrames;         // frames out of speech, margin included
+    uint64_t segments;              // speech begins
+    uint64_t prerollBytes;          // pre-roll flushed on speech begin, pcm bytes
+                                    // or aac bytes with compressed pre-roll
+    uint64_t cacheOverwriteBytes;   // pre-roll dropped from cache as it got too old
+                                    // or was trimmed by the pre-roll guard
+    uint64_t encodeDropBytes;       // pcm dropped on async encode queue overflow
+    uint64_t encodedBytes;          // encoded bytes output to listener
+    uint64_t vadTimeNs;             // downmix and VAD
+    uint64_t encodeTimeNs;          // encoder, listener excluded
+    uint64_t listenerTimeNs;        // listener callbacks
+};
+
 class VadRecorderListener {
 public:
     VadRecorderListener() : mFile(NULL) {}
@@ -35,6 +62,22 @@ public:
     virtual void onOutputBufferAvailable(char *outBuffer, int outLength) {
         if (mFile) fwrite(outBuffer, outLength, 1, mFile);
     }
+    /**
+     * Callback to notify that speech is likely to begin, raised on the first
+     * active frames so that resources can be warmed up speculatively. It is
+     * followed by either onSpeechBegin() or onSpeechCancelled(), while
+     * onSpeechBegin() may also come without it.
+     * \param N/A.
+     * \retval N/A.
+     */
+    virtual void onSpeechLikely() {}
+    /**
+     * Callback to notify that speech announced by onSpeechLikely() did not
+     * begin.
+     * \param N/A.
+     * \retval N/A.
+     */
+    virtual void onSpeechCancelled() {}
     /**
      * Callback to notify begin of speech.
      * \param N/A.
@@ -71,6 +114,15 @@ public:
         ENCODER_CNT,
     };
 
+    // How multi-channel input is mixed down to mono for VAD, encoding
+    // always keeps all channels
+    enum ChannelPolicy {
+        CHANNEL_AVERAGE = 0,    // mean of all channels
+        CHANNEL_LEFT,           // first channel only
+        CHANNEL_RIGHT,          // second channel only
+        CHANNEL_MAX_ENERGY,     // loudest channel of each VAD frame
+    };
+
     VadRecorder();
 
     ~VadRecorder();
@@ -79,25 +131,212 @@ public:
         mSpeechMarginMsMax = marginMs > 1000 ? marginMs : 1000;
     }
 
+    // VAD frame length in ms, valid value: 10/20/30, input is processed and
+    // encoded in units of it. Takes effect on next init(), 10ms by default.
+    void setVadFrameTimeMs(int frameTimeMs) {
+        mVadFrameTimeMs = frameTimeMs;
+    }
+
+    // Takes effect on next init(), CHANNEL_AVERAGE by default.
+    void setChannelPolicy(ChannelPolicy policy) {
+        mChannelPolicy = policy;
+    }
+
+    // Sample format of input pcm, bitsPerSample of init() must match it
+    // (16/24/32/32). Takes effect on next init(), SAMPLE_FORMAT_S16 by default.
+    void setSampleFormat(IAudioEncoder::SampleFormat format) {
+        mSampleFormat = format;
+    }
+
+    // Compressed pre-roll: silence is encoded along the way and the pre-roll
+    // is kept as aac frames, so that speech onset only outputs cached frames
+    // instead of encoding the whole pcm cache at once. Not available in async
+    // mode: init() then silently falls back to the pcm cache, only logging a
+    // warning, and getStats().prerollBytes counts pcm bytes. Takes effect on
+    // next init().
+    void setCompressedPreroll(bool compressed) {
+        mCompressedPreroll = compressed;
+    }
+
+    // Pre-roll guard: speech begin is detected a few hundred ms after speech
+    // started, by default the whole 1s cache is output before it. With a
+    // guard >= 0, the pre-roll is trimmed to the estimated start of speech
+    // plus guardMs, so less silence is encoded. Takes effect on next init(),
+    // -1 (whole cache) by default.
+    void setPrerollGuardMs(int guardMs) {
+        mPrerollGuardMs = guardMs;
+    }
+
+    // onSpeechLikely() after likelyMs of continuous activity, 0 disables it.
+    // Takes effect on next init(), 30ms by default.
+    void setSpeechLikelyMs(int likelyMs) {
+        mSpeechLikelyMs = likelyMs;
+    }
+
+    // Speech ends after silenceMs of silence, or earlier once the silent 10ms
+    // frames outnumber the active ones by as many. Takes effect on next init(),
+    // 700ms by default.
+    void setEosSilenceMs(int silenceMs) {
+        mEosSilenceMs = silenceMs;
+    }
+
+    // Adaptive end of speech: the silence time follows how clearly speech
+    // stands out of noise, from minMs for clean speech to maxMs in noisy
+    // conditions, instead of setEosSilenceMs(). Takes effect on next init(),
+    // off by default.
+    void setAdaptiveEos(bool adaptive, int minMs = 500, int maxMs = 1000) {
+        mAdaptiveEos = adaptive;
+        mEosMinSilenceMs = minMs;
+        mEosMaxSilenceMs = maxMs;
+    }
+
+    // Noise profile exported by getNoiseProfile(), the VAD starts with it
+    // instead of adapting to the noise for the first second or so, so a
+    // profile saved per device avoids false speech begins of new sessions
+    // in noisy rooms. Must be of the same VAD frame time. Takes effect on
+    // next init(), empty (none) by default.
+    void setNoiseProfile(const char *profile, int length) {
+        mNoiseProfile.assign(profile != NULL ? profile : "", profile != NULL ? length : 0);
+    }
+
+    // Energy pre-gate of VAD: frames within marginDb above the adaptive noise
+    // floor are taken as silence without running the full VAD, which saves
+    // most of the VAD cpu on idle streams. 6~10dB is a good start, too large
+    // a margin misses soft speech onsets. Takes effect on next init(), 0 (off)
+    // by default.
+    void setEnergyGateDb(int marginDb) {
+        mEnergyGateDb = marginDb;
+    }
+
+    // Async mode: feed() only runs VAD and queues pcm data, the encoder runs
+    // on a dedicated thread, so onOutputBufferAvailable() is called from that
+    // thread. Takes effect on next init().
+    void setAsyncEncode(bool async) {
+        mAsyncEncode = async;
+    }
+
     bool init(VadRecorderListener *listener,
               int sampleRate, int channels, int bitsPerSample,
               EncoderType encoderType = ENCODER_AAC);
 
     bool feed(char *inBuffer, int inLength);
 
+    /**
+     * Process a whole wav file faster than real time, the recorder is inited
+     * with the format of the file and deinited before returning. VAD runs
+     * over the file on the caller thread, each segment it detects is encoded
+     * on a pool of threads and output to listener in file order from the
+     * caller thread once it and those before it are encoded, while VAD goes
+     * on, so only the segments still waiting for output are kept in memory.
+     * With threadCount <= 1 the file is fed through feed(), output is the
+     * same as streaming mode byte for byte. Otherwise each segment is encoded
+     * by its own encoder, segments and events are the same as streaming mode
+     * but aac frames at segment boundaries differ.
+     * \param listener [IN] recorder listener.
+     * \param path [IN] path of a wav file, 16/24/32-bit pcm or 32-bit float.
+     * \param threadCount [IN] number of encoding threads, 0 means one per cpu core.
+     * \param encoderType [IN] encoder type.
+     * \retval true Succeeded. false Failed.
+     */
+    bool processFile(VadRecorderListener *listener, const char *path,
+                     int threadCount = 0, EncoderType encoderType = ENCODER_AAC);
+
     void deinit();
 
+    /**
+     * Get runtime statistics, can be called from any thread, counters are
+     * kept after deinit() until next init().
+     * \retval statistics snapshot.
+     */
+    VadRecorderStats getStats() const;
+
+    /**
+     * Export the noise model of VAD, for setNoiseProfile() of later sessions.
+     * Call between feed() calls of an inited recorder, best after some
+     * seconds of audio.
+     * \param buffer [OUT] profile buffer.
+     * \param length [IN] buffer length in byte, 260 bytes are enough.
+     * \retval profile length in byte, -1 on error.
+     */
+    int getNoiseProfile(char *buffer, int length);
+
+    /**
+     * Save the stream state, so that the stream can move to another recorder,
+     * e.g. of another worker process, and go on with the same decisions as if
+     * never moved: VAD models and speech state, margin, pending input and
+     * pre-roll cache. Call between feed() calls of an inited recorder. The
+     * encoder is not part of it, the restored recorder starts a new aac
+     * stream. The blob is versioned and in host byte order.
+     * \param state [OUT] state blob, replaced.
+     * \retval true Succeeded. false Failed.
+     */
+    bool serialize(std::string &state);
+
+    /**
+     * Restore a state saved by serialize() into a recorder inited with the
+     * same format and settings, before feeding the rest of the stream.
+     * \param state [IN] state blob.
+     * \param length [IN] state length in byte.
+     * \retval true Succeeded. false Failed, the recorder is left as it was.
+     */
+    bool deserialize(const char *state, int length);
+
+    /**
+     * Start writing trace records of all recorders to a binary file, see
+     * src/vadtrace.h for the format. Only trace points enabled by building
+     * with VADTRACE_LEVEL > 0 are recorded.
+     * \param path [IN] path of trace file.
+     * \retval true Succeeded. false Failed.
+     */
+    static bool startTrace(const char *path);
+
+    static void stopTrace();
+
 private:
+    // Per-frame decisions of a batch, events are notified before the frame
+    enum {
+        FRAME_ENCODE       = 1 << 0,
+        FRAME_SPEECH_BEGIN = 1 << 1,
+        FRAME_SPEECH_END   = 1 << 2,
+        FRAME_MARGIN_BEGIN = 1 << 3,
+        FRAME_MARGIN_END   = 1 << 4,
+        FRAME_SPEECH_LIKELY    = 1 << 5,
+        FRAME_SPEECH_CANCELLED = 1 << 6,
+        FRAME_EVENTS       = FRAME_SPEECH_BEGIN | FRAME_SPEECH_END |
+                             FRAME_MARGIN_BEGIN | FRAME_MARGIN_END |
+                             FRAME_SPEECH_LIKELY | FRAME_SPEECH_CANCELLED,
+    };
+
     bool mInited;
     VadRecorderListener *mRecorderListener;
     int mSampleRate;
     int mChannels;
     int mBitsPerSample;
+    int mFrameTimeMs;
+    int mFrameBytes;
+    int mCacheBytes;
+    int mVadFrameTimeMs;
     EncoderType mEncoderType;
     IAudioEncoder *mEncoderHandle;
     IAudioEncoderListener *mEncoderListener;
     void *mVadHandle;
     char *mVadMonoBuffer;
+    char *mVadConvertBuffer;
+    IAudioEncoder::SampleFormat mSampleFormat;
+    int   mPcmFormat;
+    webrtc::Resampler *mVadResampler;
+    char *mVadResampleBuffer;
+    int   mVadSampleRate;
+    int   mVadFrameSamples;
+    ChannelPolicy mChannelPolicy;
+    int   mVadChannelPolicy;
+    int   mEnergyGateDb;
+    std::string mNoiseProfile;
+    int   mSpeechLikelyMs;
+    int   mEosSilenceMs;
+    bool  mAdaptiveEos;
+    int   mEosMinSilenceMs;
+    int   mEosMaxSilenceMs;
     bool  mSpeechDetected;
     int   mSpeechMarginMsMax;
     int   mSpeechMarginMsVal;
@@ -105,11 +344,35 @@ private:
     int   mInputBufferSize;
     int   mInputBufferRemain;
     void *mCacheRingbuf;
-    char *mCacheBuffer;
-    int   mCacheBufferSize;
+    bool  mCompressedPreroll;
+    AdtsFrameCache *mPrerollCache;
+    int   mPrerollGuardMs;
+    int   mPrerollGuardBytes;
+    int   mPrerollBytes;
+    int64_t mVadSamples;
+    bool  mAsyncEncode;
+    void *mEncodeRingbuf;
+    std::thread *mEncodeThread;
+    bool  mEncodeThreadExit;    // guarded by mEncodeLock
+    bool  mEncodePending;       // queue written since last wakeup, guarded by mEncodeLock
+    std::mutex mEncodeLock;
+    std::condition_variable mEncodeCond;
+    VadRecorderCounters *mCounters;
 
 private:
-    bool process(char *inBuffer, int inLength);
+    bool process(char *inBuffer, int frameCount);
+    bool analyzeFrames(char *frames, int frameCount, unsigned char *flags, int *prerolls);
+    int  updateFrameState(int vadResult);
+    int  prerollBytes(int64_t boundary, int64_t frameStart);
+    void notifyEvents(int flags);
+    bool outputSpan(char *buffer, int length, bool needEncode);
+    bool encodeBuffer(char *buffer, int length);
+    bool runEncoder(char *buffer, int length);
+    bool flushCache();
+    void encodeThreadLoop();
+    void stopEncodeThread();
+    void release();
+    bool processSegments(const char *data, size_t dataLength, int threadCount);
 };
 
 #endif // __VADRECORDER_H
@@ -0,0 +1,104 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <set>
+#include <vector>
+#include "VadRecorder.hpp"
+
+#ifndef __VADRECORDERENGINE_H
+#define __VADRECORDERENGINE_H
+
+// VadRecorderEngine runs many VadRecorder streams on a fixed pool of worker
+// threads. Callers only enqueue pcm data, VAD and encoding are done by the
+// workers, idle workers steal pending streams from busy ones.
+// NOTICE: recorder listeners are called from worker threads.
+class VadRecorderEngine
+{
+public:
+    typedef void *StreamHandle;
+
+    VadRecorderEngine();
+
+    ~VadRecorderEngine();
+
+    /**
+     * Start worker threads.
+     * \param workerCount [IN] number of worker threads, 0 means one per cpu core.
+     * \retval true Succeeded. false Failed.
+     */
+    bool init(int workerCount = 0);
+
+    /**
+     * Register an inited recorder to the engine.
+     * \param recorder [IN] recorder inited by caller, not owned by the engine.
+     * \param queueSize [IN] size in byte of the pending pcm queue of the stream.
+     * \retval stream handle, NULL if failed.
+     */
+    StreamHandle createStream(VadRecorder *recorder, int queueSize);
+
+    /**
+     * Enqueue pcm data of a stream, it never blocks on VAD or encoding.
+     * Only one thread should feed a given stream at a time.
+     * \param stream [IN] stream handle.
+     * \param inBuffer [IN] input buffer pointer, input pcm data.
+     * \param inLength [IN] input buffer length in byte.
+     * \retval true Succeeded. false Failed, e.g. pending queue is full.
+     */
+    bool feed(StreamHandle stream, char *inBuffer, int inLength);
+
+    /**
+     * Unregister a stream, pending pcm data is processed before returning,
+     * after that the recorder can be deleted by caller.
+     * \param stream [IN] stream handle.
+     * \retval N/A.
+     */
+    void destroyStream(StreamHandle stream);
+
+    /**
+     * Stop worker threads, streams should be destroyed before.
+     * \retval N/A.
+     */
+    void deinit();
+
+private:
+    struct Stream;
+    struct Worker;
+
+    bool mInited;
+    std::atomic<bool> mRunning;
+    std::vector<Worker *> mWorkers;
+    std::atomic<int> mPendingTasks;
+    std::atomic<int> mSleepingWorkers;
+    std::mutex mIdleLock;
+    std::condition_variable mIdleCond;
+    std::mutex mStreamsLock;
+    std::set<std::shared_ptr<Stream> > mStreams;
+    std::atomic<unsigned int> mNextWorker;
+
+private:
+    void schedule(const std::shared_ptr<Stream> &stream, int workerIndex);
+    std::shared_ptr<Stream> pickTask(int workerIndex);
+    void processStream(const std::shared_ptr<Stream> &stream, int workerIndex);
+    void workerLoop(int workerIndex);
+};
+
+#endif // __VADRECORDERENGINE_H
@@ -0,0 +1,155 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <stdio.h>
+#include "logger.h"
+#include "lockfree_ringbuf.h"
+#include "AdtsFrameCache.hpp"
+
+#define TAG "AdtsFrameCache"
+
+static const int kAdtsHeaderSize = 7;
+
+// Returns frame length written in ADTS header, or -1 if not an ADTS header
+static int adtsFrameLength(const unsigned char *data, int length)
+{
+    if (length < kAdtsHeaderSize || data[0] != 0xFF || (data[1] & 0xF0) != 0xF0)
+        return -1;
+    return ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+}
+
+AdtsFrameCache::AdtsFrameCache()
+    : mRingbuf(NULL),
+      mFrameSizes(NULL),
+      mMaxFrames(0),
+      mFrameHead(0),
+      mFrameCount(0)
+{}
+
+AdtsFrameCache::~AdtsFrameCache()
+{
+    deinit();
+}
+
+bool AdtsFrameCache::init(int maxFrames, int maxBytes)
+{
+    deinit();
+    if (maxFrames <= 0 || maxBytes <= 0)
+        return false;
+    mRingbuf = lockfree_ringbuf_create(maxBytes);
+    if (mRingbuf == NULL)
+        return false;
+    mFrameSizes = new int[maxFrames];
+    mMaxFrames = maxFrames;
+    mFrameHead = 0;
+    mFrameCount = 0;
+    return true;
+}
+
+int AdtsFrameCache::dropOldest()
+{
+    int frameSize = mFrameSizes[mFrameHead];
+    lockfree_ringbuf_consume(mRingbuf, frameSize);
+    mFrameHead = (mFrameHead + 1) % mMaxFrames;
+    mFrameCount--;
+    return frameSize;
+}
+
+int AdtsFrameCache::write(char *buffer, int length)
+{
+    if (mRingbuf == NULL)
+        return 0;
+    int droppedSize = 0;
+    int ringSize = lockfree_ringbuf_get_size(mRingbuf);
+    while (length > 0) {
+        int frameSize = adtsFrameLength((unsigned char *)buffer, length);
+        if (frameSize <= 0 || frameSize > length) {
+            // Not framed as expected, keep the rest as a single unit
+            frameSize = length;
+        }
+        if (frameSize <= ringSize) {
+            while (mFrameCount > 0 &&
+                   (mFrameCount == mMaxFrames ||
+                    lockfree_ringbuf_bytes_available(mRingbuf) < frameSize))
+                droppedSize += dropOldest();
+            lockfree_ringbuf_write(mRingbuf, buffer, frameSize);
+            mFrameSizes[(mFrameHead + mFrameCount) % mMaxFrames] = frameSize;
+            mFrameCount++;
+        } else {
+            pr_wrn("Frame too large to cache: size:%d", frameSize);
+        }
+        buffer += frameSize;
+        length -= frameSize;
+    }
+    return droppedSize;
+}
+
+int AdtsFrameCache::trim(int maxFrames)
+{
+    int droppedSize = 0;
+    while (mFrameCount > 0 && mFrameCount > maxFrames)
+        droppedSize += dropOldest();
+    return droppedSize;
+}
+
+int AdtsFrameCache::flush(VadRecorderListener *listener)
+{
+    if (mRingbuf == NULL || mFrameCount == 0)
+        return 0;
+    char *buf1, *buf2;
+    int len1, len2;
+    int size = lockfree_ringbuf_peek(mRingbuf, &buf1, &len1, &buf2, &len2);
+    if (len1 > 0)
+        listener->onOutputBufferAvailable(buf1, len1);
+    if (len2 > 0)
+        listener->onOutputBufferAvailable(buf2, len2);
+    reset();
+    return size;
+}
+
+void AdtsFrameCache::save(std::string &frames)
+{
+    if (mRingbuf == NULL || mFrameCount == 0)
+        return;
+    char *buf1, *buf2;
+    int len1, len2;
+    lockfree_ringbuf_peek(mRingbuf, &buf1, &len1, &buf2, &len2);
+    if (len1 > 0)
+        frames.append(buf1, len1);
+    if (len2 > 0)
+        frames.append(buf2, len2);
+}
+
+void AdtsFrameCache::reset()
+{
+    if (mRingbuf != NULL)
+        lockfree_ringbuf_unsafe_reset(mRingbuf);
+    mFrameHead = 0;
+    mFrameCount = 0;
+}
+
+void AdtsFrameCache::deinit()
+{
+    if (mRingbuf != NULL) {
+        lockfree_ringbuf_destroy(mRingbuf);
+        mRingbuf = NULL;
+    }
+    delete [] mFrameSizes;
+    mFrameSizes = NULL;
+    mMaxFrames = 0;
+    mFrameHead = 0;
+    mFrameCount = 0;
+}
@@ -0,0 +1,63 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef __ADTSFRAMECACHE_H
+#define __ADTSFRAMECACHE_H
+
+#include "VadRecorder.hpp"
+
+// Bounded cache of encoded ADTS frames, the oldest frames are dropped when
+// the cache is full. Used to keep the pre-roll already encoded.
+class AdtsFrameCache
+{
+public:
+    AdtsFrameCache();
+
+    ~AdtsFrameCache();
+
+    bool init(int maxFrames, int maxBytes);
+
+    // Append encoded data, it's split into ADTS frames, returns bytes of old
+    // frames dropped to make room
+    int write(char *buffer, int length);
+
+    // Output all cached frames to listener and empty the cache
+    int flush(VadRecorderListener *listener);
+
+    // Drop the oldest frames to keep at most maxFrames, returns bytes dropped
+    int trim(int maxFrames);
+
+    int frameCount() const { return mFrameCount; }
+
+    // Append all cached frames to frames, they stay in cache. Writing them
+    // to an empty cache restores it.
+    void save(std::string &frames);
+
+    void reset();
+
+    void deinit();
+
+private:
+    void *mRingbuf;
+    int  *mFrameSizes;
+    int   mMaxFrames;
+    int   mFrameHead;
+    int   mFrameCount;
+
+    int dropOldest();
+};
+
+#endif // __ADTSFRAMECACHE_H
@@ -15,63 +15,146 @@
  */
 
 #include <string.h>
+#include "resampler/resampler.h"
 #include "logger.h"
 #include "litevad.h"
 #include "IAudioEncoder.hpp"
 #include "VoAACEncoder.hpp"
 #include "lockfree_ringbuf.h"
+#include "pcm_convert.h"
+#include "pcm_downmix.h"
+#include "AdtsFrameCache.hpp"
+#include "VadRecorderCounters.hpp"
+#include "vadtrace.h"
 #include "VadRecorder.hpp"
 
 #define TAG "VadRecorder"
 
 static const int kCacheTimeInMs = 1000;
+static const int kDefaultVadFrameTimeInMs = 10;
+static const int kDefaultSpeechLikelyTimeInMs = 30;
+// Max frames of one feed() that go through VAD before being output
+static const int kMaxBatchFrames = 64;
+
+// Pending pcm of async encoder on top of one batch and the pre-roll cache
+// flushed with it, leaves the encoder thread this much lag
+static const int kEncodeHeadroomTimeInMs = 1000;
+
+// Header of serialize() state, followed by the input remainder, the pre-roll
+// cache, the resampler state and the litevad state, in host byte order
+struct VadRecorderState {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t frameTimeMs;
+    int32_t  sampleRate;
+    int16_t  channels;
+    int16_t  bitsPerSample;
+    int32_t  compressedPreroll;
+    int32_t  speechDetected;
+    int32_t  speechMarginMsVal;
+    int32_t  prerollBytes;
+    int64_t  vadSamples;
+    int32_t  inputBytes;
+    int32_t  cacheBytes;
+    int32_t  resamplerBytes;
+    int32_t  vadBytes;
+};
+static const uint32_t kStateMagic = 0x54535256;    // "VRST"
+static const uint16_t kStateVersion = 1;
+
+// Input rates litevad doesn't take, VAD runs on a 16kHz resampled signal.
+// The webrtc resampler works on nominal rates, 44.1kHz is taken as 44kHz like
+// the frame sizes of VadRecorder, so a 10ms VAD frame is 440 samples.
+static const struct {
+    int sampleRate;
+    int resamplerRate;
+} kVadResampleRates[] = {
+    { 11025, 11000 },
+    { 22050, 22000 },
+    { 44100, 44000 },
+    { 64000, 64000 },
+    { 88200, 88000 },
+    { 96000, 96000 },
+};
+static const int kVadResampleOutputRate = 16000;
 
 class VoAACEncoderListener : public IAudioEncoderListener
 {
 public:
-    VoAACEncoderListener(VadRecorderListener *listener)
-        : mRecorderListener(listener) {}
+    VoAACEncoderListener(VadRecorderListener *listener, VadRecorderCounters *counters)
+        : mRecorderListener(listener), mCounters(counters), mHoldingCache(NULL) {}
     void onOutputBufferAvailable(char *outBuffer, int outLength) {
-        mRecorderListener->onOutputBufferAvailable(outBuffer, outLength);
+        if (mHoldingCache != NULL) {
+            int droppedSize = mHoldingCache->write(outBuffer, outLength);
+            VadRecorderCounters::add(mCounters->cacheOverwriteBytes, droppedSize);
+        } else {
+            uint64_t start = VadRecorderCounters::threadCpuTimeNs();
+            vadtrace_stage(VADTRACE_LISTENER_BEGIN, outLength, 0);
+            mRecorderListener->onOutputBufferAvailable(outBuffer, outLength);
+            vadtrace_stage(VADTRACE_LISTENER_END, 0, 0);
+            VadRecorderCounters::add(mCounters->outputListenerTimeNs,
+                                     VadRecorderCounters::threadCpuTimeNs() - start);
+            VadRecorderCounters::add(mCounters->encodedBytes, outLength);
+        }
+    }
+    // Keep encoded data in cache instead of outputting it, NULL to output
+    void setHoldingCache(AdtsFrameCache *cache) {
+        mHoldingCache = cache;
     }
 private:
     VadRecorderListener *mRecorderListener;
+    VadRecorderCounters *mCounters;
+    AdtsFrameCache *mHoldingCache;
 };
 
 VadRecorder::VadRecorder()
     : mInited(false),
       mRecorderListener(NULL),
+      mVadFrameTimeMs(kDefaultVadFrameTimeInMs),
       mEncoderType(ENCODER_AAC),
       mEncoderHandle(NULL),
       mEncoderListener(NULL),
       mVadHandle(NULL),
       mVadMonoBuffer(NULL),
+      mVadConvertBuffer(NULL),
+      mSampleFormat(IAudioEncoder::SAMPLE_FORMAT_S16),
+      mPcmFormat(PCM_FORMAT_S16),
+      mVadResampler(NULL),
+      mVadResampleBuffer(NULL),
+      mVadSampleRate(0),
+      mVadFrameSamples(0),
+      mChannelPolicy(CHANNEL_AVERAGE),
+      mVadChannelPolicy(PCM_DOWNMIX_AVERAGE),
+      mEnergyGateDb(0),
+      mSpeechLikelyMs(kDefaultSpeechLikelyTimeInMs),
+      mEosSilenceMs(0),
+      mAdaptiveEos(false),
+      mEosMinSilenceMs(0),
+      mEosMaxSilenceMs(0),
       mSpeechDetected(false),
       mSpeechMarginMsMax(0),
       mSpeechMarginMsVal(0),
       mInputBuffer(NULL),
       mInputBufferRemain(0),
       mCacheRingbuf(NULL),
-      mCacheBuffer(NULL),
-      mCacheBufferSize(0)
+      mCompressedPreroll(false),
+      mPrerollCache(NULL),
+      mPrerollGuardMs(-1),
+      mPrerollGuardBytes(-1),
+      mPrerollBytes(0),
+      mVadSamples(0),
+      mAsyncEncode(false),
+      mEncodeRingbuf(NULL),
+      mEncodeThread(NULL),
+      mEncodeThreadExit(false),
+      mEncodePending(false),
+      mCounters(new VadRecorderCounters())
 {}
 
 VadRecorder::~VadRecorder()
 {
-    if (mVadHandle != NULL)
-        litevad_destroy(mVadHandle);
-    if (mVadMonoBuffer != NULL)
-        delete [] mVadMonoBuffer;
-    if (mEncoderHandle != NULL)
-        delete mEncoderHandle;
-    if (mEncoderListener != NULL)
-        delete mEncoderListener;
-    if (mInputBuffer != NULL)
-        delete [] mInputBuffer;
-    if (mCacheBuffer != NULL)
-        delete [] mCacheBuffer;
-    if (mCacheRingbuf != NULL)
-        lockfree_ringbuf_destroy(mCacheRingbuf);
+    release();
+    delete mCounters;
 }
 
 bool VadRecorder::init(VadRecorderListener *listener,
@@ -90,45 +173,154 @@ bool VadRecorder::init(VadRecorderListener *listener,
         return false;
     }
 
-    int frameCountPer10Ms = sampleRate/100;
-    int frameBytesPer10Ms = frameCountPer10Ms*channels*bitsPerSample/8;
+    int frameTimeMs = mVadFrameTimeMs;
+    if (frameTimeMs != 10 && frameTimeMs != 20 && frameTimeMs != 30) {
+        pr_err("Invalid vad frame time, valid value: 10/20/30");
+        return false;
+    }
+
+    int pcmFormat;
+    switch (mSampleFormat) {
+    case IAudioEncoder::SAMPLE_FORMAT_S16:     pcmFormat = PCM_FORMAT_S16; break;
+    case IAudioEncoder::SAMPLE_FORMAT_S24_3LE: pcmFormat = PCM_FORMAT_S24_3LE; break;
+    case IAudioEncoder::SAMPLE_FORMAT_S32:     pcmFormat = PCM_FORMAT_S32; break;
+    case IAudioEncoder::SAMPLE_FORMAT_F32:     pcmFormat = PCM_FORMAT_F32; break;
+    default:                                   pcmFormat = -1; break;
+    }
+    if (pcmFormat < 0 || bitsPerSample != pcm_format_bytes((pcm_format_t)pcmFormat)*8) {
+        pr_err("Invalid sample bits %d for sample format %d", bitsPerSample, mSampleFormat);
+        return false;
+    }
+
+    int bytesPerMs = sampleRate/1000*channels*bitsPerSample/8;
+    int frameCount = sampleRate/1000*frameTimeMs;
+    int frameBytes = bytesPerMs*frameTimeMs;
 
     mInputBufferRemain = 0;
-    mInputBufferSize = frameBytesPer10Ms*3;
+    mInputBufferSize = frameBytes;
     mInputBuffer = new char[mInputBufferSize];
 
-    mCacheBufferSize = frameBytesPer10Ms*10; // cache buffer for 100ms data
-    mCacheBuffer = new char[mCacheBufferSize];
-    mCacheRingbuf = lockfree_ringbuf_create(frameBytesPer10Ms*kCacheTimeInMs/10);
-    if (mCacheRingbuf == NULL) {
-        pr_err("Failed to allocate cache buffer");
-        return false;
+    bool compressedPreroll = mCompressedPreroll;
+    if (compressedPreroll && mAsyncEncode) {
+        pr_wrn("Compressed pre-roll is not supported in async mode, disable it");
+        compressedPreroll = false;
+    }
+    if (!compressedPreroll) {
+        mCacheRingbuf = lockfree_ringbuf_create(bytesPerMs*kCacheTimeInMs);
+        if (mCacheRingbuf == NULL) {
+            pr_err("Failed to allocate cache buffer");
+            release();
+            return false;
+        }
     }
 
-    mVadHandle = litevad_create(sampleRate, 1, bitsPerSample);
+    int vadSampleRate = sampleRate;
+    for (size_t i = 0; i < sizeof(kVadResampleRates)/sizeof(kVadResampleRates[0]); i++) {
+        if (sampleRate == kVadResampleRates[i].sampleRate) {
+            vadSampleRate = kVadResampleOutputRate;
+            mVadResampler = new webrtc::Resampler();
+            if (mVadResampler->Reset(kVadResampleRates[i].resamplerRate, vadSampleRate, 1) != 0) {
+                pr_err("Failed to init resampler: %dHz to %dHz", sampleRate, vadSampleRate);
+                release();
+                return false;
+            }
+            mVadResampleBuffer = new char[kMaxBatchFrames*(vadSampleRate/1000*frameTimeMs)*sizeof(short)];
+            break;
+        }
+    }
+
+    // VAD runs on 16-bit mono, converted frame by frame from input
+    mVadHandle = litevad_create(vadSampleRate, 1, 16, frameTimeMs);
     if (mVadHandle == NULL) {
         pr_err("Failed to litevad_create");
+        release();
+        return false;
+    }
+    litevad_config_t vadConfig;
+    litevad_get_config(mVadHandle, &vadConfig);
+    vadConfig.bos_likely_time = mSpeechLikelyMs > 0 ? mSpeechLikelyMs : 0;
+    if (mEosSilenceMs > 0)
+        vadConfig.eos_silence_time = mEosSilenceMs;
+    if (mAdaptiveEos) {
+        vadConfig.eos_adaptive = 1;
+        vadConfig.eos_min_silence_time = mEosMinSilenceMs;
+        vadConfig.eos_max_silence_time = mEosMaxSilenceMs;
+    }
+    if (litevad_set_config(mVadHandle, &vadConfig) != 0) {
+        pr_err("Failed to set vad config");
+        release();
         return false;
     }
-    if (channels == 2)
-        mVadMonoBuffer = new char[(frameCountPer10Ms*sizeof(short))*3];
+    if (!mNoiseProfile.empty() &&
+        litevad_set_noise_profile(mVadHandle, mNoiseProfile.data(), mNoiseProfile.size()) != 0) {
+        pr_err("Failed to set noise profile");
+        release();
+        return false;
+    }
+    if (litevad_set_energy_gate(mVadHandle, mEnergyGateDb) != 0) {
+        pr_err("Failed to set energy gate: %ddB", mEnergyGateDb);
+        release();
+        return false;
+    }
+    if (channels > 1 || pcmFormat != PCM_FORMAT_S16)
+        mVadMonoBuffer = new char[kMaxBatchFrames*frameCount*sizeof(short)];
+    if (channels > 1 && pcmFormat != PCM_FORMAT_S16)
+        mVadConvertBuffer = new char[frameCount*channels*sizeof(short)];
+    if (channels > 1) {
+        switch (mChannelPolicy) {
+        case CHANNEL_LEFT:       mVadChannelPolicy = PCM_DOWNMIX_LEFT; break;
+        case CHANNEL_RIGHT:      mVadChannelPolicy = PCM_DOWNMIX_RIGHT; break;
+        case CHANNEL_MAX_ENERGY: mVadChannelPolicy = PCM_DOWNMIX_MAX_ENERGY; break;
+        default:                 mVadChannelPolicy = PCM_DOWNMIX_AVERAGE; break;
+        }
+    }
 
     switch (encoderType) {
     case ENCODER_AAC:
         mEncoderHandle = new VoAACEncoder();
-        mEncoderListener = new VoAACEncoderListener(listener);
+        mEncoderListener = new VoAACEncoderListener(listener, mCounters);
         break;
     default:
         pr_err("Invalid encoder type, only aac supported");
+        release();
         return false;
     }
 
-    int ret = mEncoderHandle->init(mEncoderListener, sampleRate, channels, bitsPerSample);
+    int ret = mEncoderHandle->init(mEncoderListener, sampleRate, channels, bitsPerSample, mSampleFormat);
     if (ret != IAudioEncoder::ENCODER_NOERROR) {
         pr_err("Failed to init audio encoder");
+        release();
         return false;
     }
 
+    if (compressedPreroll) {
+        // Pre-roll is kept as aac frames of 1024 samples, bytes are bounded
+        // by twice the average frame size in case of bitrate peaks
+        int maxFrames = (sampleRate*kCacheTimeInMs/1000 + 1023)/1024;
+        int aacFrameBytes = mEncoderHandle->getBitRate()/8*1024/sampleRate;
+        mPrerollCache = new AdtsFrameCache();
+        if (!mPrerollCache->init(maxFrames, maxFrames*aacFrameBytes*2)) {
+            pr_err("Failed to allocate pre-roll cache");
+            release();
+            return false;
+        }
+        static_cast<VoAACEncoderListener *>(mEncoderListener)->setHoldingCache(mPrerollCache);
+    }
+
+    if (mAsyncEncode) {
+        // A batch starting speech is queued right after its pre-roll
+        int queueTimeMs = kMaxBatchFrames*frameTimeMs + kCacheTimeInMs + kEncodeHeadroomTimeInMs;
+        mEncodeRingbuf = lockfree_ringbuf_create(bytesPerMs*queueTimeMs);
+        if (mEncodeRingbuf == NULL) {
+            pr_err("Failed to allocate encode queue");
+            release();
+            return false;
+        }
+        mEncodeThreadExit = false;
+        mEncodePending = false;
+        mEncodeThread = new std::thread(&VadRecorder::encodeThreadLoop, this);
+    }
+
     mRecorderListener = listener;
     mEncoderType = encoderType;
     mSpeechDetected = false;
@@ -136,78 +328,352 @@ bool VadRecorder::init(VadRecorderListener *listener,
     mSampleRate = sampleRate;
     mChannels = channels;
     mBitsPerSample = bitsPerSample;
+    mPcmFormat = pcmFormat;
+    mFrameTimeMs = frameTimeMs;
+    mFrameBytes = frameBytes;
+    mVadSampleRate = vadSampleRate;
+    mVadFrameSamples = vadSampleRate/1000*frameTimeMs;
+    mCacheBytes = bytesPerMs*kCacheTimeInMs;
+    mPrerollGuardBytes = mPrerollGuardMs >= 0 ? bytesPerMs*mPrerollGuardMs : -1;
+    mPrerollBytes = mCacheBytes;
+    mVadSamples = 0;
+    mCounters->reset();
     mInited = true;
     return mInited;
 }
 
-bool VadRecorder::process(char *inBuffer, int inLength)
+bool VadRecorder::analyzeFrames(char *frames, int frameCount, unsigned char *flags, int *prerolls)
 {
-    char *vadBuffer = inBuffer;
-    int vadLength = inLength;
+    unsigned char results[kMaxBatchFrames];
+    int64_t boundaries[kMaxBatchFrames];
+
+    while (frameCount > 0) {
+        int batchFrames = frameCount < kMaxBatchFrames ? frameCount : kMaxBatchFrames;
+        char *vadBuffer = frames;
+        int vadLength = batchFrames*mFrameBytes;
+
+        if (mChannels > 1 || mPcmFormat != PCM_FORMAT_S16) {
+            // Convert and downmix frame by frame, so that converted samples
+            // stay in cache, and channel selection is per VAD frame
+            int nFrames = mFrameBytes/(mChannels*mBitsPerSample/8);
+            for (int i = 0; i < batchFrames; i++) {
+                const short *pcm = (const short *)&frames[i*mFrameBytes];
+                short *mono = (short *)&mVadMonoBuffer[i*nFrames*sizeof(short)];
+                if (mPcmFormat != PCM_FORMAT_S16) {
+                    short *out = mChannels > 1 ? (short *)mVadConvertBuffer : mono;
+                    pcm_convert_s16(pcm, (pcm_format_t)mPcmFormat, nFrames*mChannels, out);
+                    pcm = out;
+                }
+                if (mChannels > 1)
+                    pcm_downmix_s16(pcm, nFrames, mChannels,
+                                    (pcm_downmix_policy_t)mVadChannelPolicy, mono);
+            }
+            vadBuffer = mVadMonoBuffer;
+            vadLength = batchFrames*nFrames*sizeof(short);
+        }
+
+        if (mVadSampleRate != mSampleRate) {
+            size_t outLen = 0;
+            size_t maxLen = batchFrames*mVadFrameSamples;
+            if (mVadResampler->Push((int16_t *)vadBuffer, vadLength/sizeof(short),
+                                    (int16_t *)mVadResampleBuffer, maxLen, outLen) != 0 ||
+                outLen != maxLen) {
+                pr_err("Failed to resample vad input");
+                return false;
+            }
+            vadBuffer = mVadResampleBuffer;
+            vadLength = outLen*sizeof(short);
+        }
+
+        if (litevad_process_frames(mVadHandle, vadBuffer, vadLength, results, boundaries) != batchFrames) {
+            pr_err("Invalid litevad result");
+            return false;
+        }
+
+        int speechFrames = 0;
+        for (int i = 0; i < batchFrames; i++) {
+            flags[i] = (unsigned char)updateFrameState((litevad_result_t)results[i]);
+            if ((flags[i] & FRAME_SPEECH_BEGIN) && prerolls != NULL)
+                prerolls[i] = prerollBytes(boundaries[i], mVadSamples + i*mVadFrameSamples);
+            if (mSpeechDetected)
+                speechFrames++;
+        }
+        mVadSamples += batchFrames*mVadFrameSamples;
+        VadRecorderCounters::add(mCounters->framesProcessed, batchFrames);
+        VadRecorderCounters::add(mCounters->speechFrames, speechFrames);
+        VadRecorderCounters::add(mCounters->silenceFrames, batchFrames - speechFrames);
 
-    if (mChannels == 2 && mVadMonoBuffer != NULL) {
-        int nFrames = inLength / (mChannels*sizeof(short));
-        short *monoBuffer = (short *)mVadMonoBuffer;
-        short *stereoBuffer = (short *)inBuffer;
-        for (int i = 0; i < nFrames; i++)
-           monoBuffer[i] = stereoBuffer[i*2];
-        vadBuffer = mVadMonoBuffer;
-        vadLength = nFrames*sizeof(short);
+        frames += batchFrames*mFrameBytes;
+        flags += batchFrames;
+        if (prerolls != NULL)
+            prerolls += batchFrames;
+        frameCount -= batchFrames;
     }
+    return true;
+}
+
+int VadRecorder::updateFrameState(int vadResult)
+{
+    int flags = 0;
 
-    litevad_result_t vadResult = litevad_process(mVadHandle, vadBuffer, vadLength);
     switch (vadResult) {
+    case LITEVAD_RESULT_SPEECH_LIKELY:
+        flags |= FRAME_SPEECH_LIKELY;
+        break;
+    case LITEVAD_RESULT_SPEECH_CANCELLED:
+        flags |= FRAME_SPEECH_CANCELLED;
+        break;
     case LITEVAD_RESULT_SPEECH_BEGIN:
         mSpeechDetected = true;
-        mRecorderListener->onSpeechBegin();
+        flags |= FRAME_SPEECH_BEGIN;
+        VadRecorderCounters::add(mCounters->segments, 1);
         break;
     case LITEVAD_RESULT_SPEECH_END:
         mSpeechDetected = false;
         mSpeechMarginMsVal = 0;
-        mRecorderListener->onSpeechEnd();
+        flags |= FRAME_SPEECH_END;
         if (mSpeechMarginMsMax > 0)
-            mRecorderListener->onMarginBegin();
+            flags |= FRAME_MARGIN_BEGIN;
         break;
-    case LITEVAD_RESULT_ERROR:
-        pr_err("Invalid litevad result");
-        return false;
     default:
         break;
     }
 
-    bool needEncode = mSpeechDetected;
-    if (!mSpeechDetected) {
-        if (mSpeechMarginMsMax > 0 && mSpeechMarginMsVal <= mSpeechMarginMsMax) {
-            needEncode = true;
-            mSpeechMarginMsVal += inLength*1000/(mSampleRate*mChannels*mBitsPerSample/8);
-            if (mSpeechMarginMsVal > mSpeechMarginMsMax)
-                mRecorderListener->onMarginEnd();
+    if (mSpeechDetected) {
+        flags |= FRAME_ENCODE;
+    } else if (mSpeechMarginMsMax > 0 && mSpeechMarginMsVal <= mSpeechMarginMsMax) {
+        flags |= FRAME_ENCODE;
+        mSpeechMarginMsVal += mFrameTimeMs;
+        if (mSpeechMarginMsVal > mSpeechMarginMsMax)
+            flags |= FRAME_MARGIN_END;
+    }
+    return flags;
+}
+
+// Pre-roll needed before a speech begin frame, from the boundary estimated by
+// litevad plus the guard, bounded by the cache. Samples are counted at VAD
+// rate.
+int VadRecorder::prerollBytes(int64_t boundary, int64_t frameStart)
+{
+    if (mPrerollGuardBytes < 0)
+        return mCacheBytes;
+    int64_t leadSamples = frameStart > boundary ? frameStart - boundary : 0;
+    int sampleBytes = mChannels*mBitsPerSample/8;
+    int64_t bytes = leadSamples*(mFrameBytes/sampleBytes)/mVadFrameSamples*sampleBytes + mPrerollGuardBytes;
+    return bytes < mCacheBytes ? (int)bytes : mCacheBytes;
+}
+
+void VadRecorder::notifyEvents(int flags)
+{
+    if ((flags & FRAME_EVENTS) == 0)
+        return;
+    uint64_t start = VadRecorderCounters::threadCpuTimeNs();
+    vadtrace_stage(VADTRACE_LISTENER_BEGIN, 0, flags & FRAME_EVENTS);
+    if (flags & FRAME_SPEECH_LIKELY)
+        mRecorderListener->onSpeechLikely();
+    if (flags & FRAME_SPEECH_CANCELLED)
+        mRecorderListener->onSpeechCancelled();
+    if (flags & FRAME_SPEECH_BEGIN)
+        mRecorderListener->onSpeechBegin();
+    if (flags & FRAME_SPEECH_END)
+        mRecorderListener->onSpeechEnd();
+    if (flags & FRAME_MARGIN_BEGIN)
+        mRecorderListener->onMarginBegin();
+    if (flags & FRAME_MARGIN_END)
+        mRecorderListener->onMarginEnd();
+    vadtrace_stage(VADTRACE_LISTENER_END, 0, 0);
+    VadRecorderCounters::add(mCounters->eventListenerTimeNs,
+                             VadRecorderCounters::threadCpuTimeNs() - start);
+}
+
+bool VadRecorder::process(char *inBuffer, int frameCount)
+{
+    unsigned char flags[kMaxBatchFrames];
+    int prerolls[kMaxBatchFrames];
+
+    while (frameCount > 0) {
+        int batchFrames = frameCount < kMaxBatchFrames ? frameCount : kMaxBatchFrames;
+
+        // Run VAD over the whole batch first
+        uint64_t vadStart = VadRecorderCounters::threadCpuTimeNs();
+        vadtrace_stage(VADTRACE_VAD_BEGIN, batchFrames, 0);
+        bool analyzed = analyzeFrames(inBuffer, batchFrames, flags, prerolls);
+        vadtrace_stage(VADTRACE_VAD_END, analyzed ? batchFrames : 0, 0);
+        VadRecorderCounters::add(mCounters->vadTimeNs,
+                                 VadRecorderCounters::threadCpuTimeNs() - vadStart);
+        if (!analyzed)
+            return false;
+
+        // Then output contiguous frames of the same state as one span, events
+        // split spans so that they are notified right before their frame
+        int spanStart = 0;
+        for (int i = 0; i < batchFrames; i++) {
+            if (i > spanStart &&
+                ((flags[i] & FRAME_EVENTS) != 0 ||
+                 (flags[i] & FRAME_ENCODE) != (flags[spanStart] & FRAME_ENCODE))) {
+                if (!outputSpan(&inBuffer[spanStart*mFrameBytes], (i - spanStart)*mFrameBytes,
+                                (flags[spanStart] & FRAME_ENCODE) != 0))
+                    return false;
+                spanStart = i;
+            }
+            if (flags[i] & FRAME_SPEECH_BEGIN)
+                mPrerollBytes = prerolls[i];
+            notifyEvents(flags[i]);
         }
+        if (!outputSpan(&inBuffer[spanStart*mFrameBytes], (batchFrames - spanStart)*mFrameBytes,
+                        (flags[spanStart] & FRAME_ENCODE) != 0))
+            return false;
+
+        inBuffer += batchFrames*mFrameBytes;
+        frameCount -= batchFrames;
     }
+    return true;
+}
 
-    if (needEncode) {
-        int cacheSize = lockfree_ringbuf_bytes_filled(mCacheRingbuf);
-        pr_dbg("Encode cache buffer: size:%d", cacheSize);
-        while (cacheSize > 0) {
-            int readSize = lockfree_ringbuf_read(mCacheRingbuf, mCacheBuffer, mCacheBufferSize);
-            if (readSize > 0) {
-                mEncoderHandle->encode(mCacheBuffer, readSize);
-                cacheSize -= readSize;
-            } else {
-                break;
+bool VadRecorder::outputSpan(char *buffer, int length, bool needEncode)
+{
+    if (mPrerollCache != NULL) {
+        // Encode every frame, the ones not needed yet are held as pre-roll
+        VoAACEncoderListener *listener = static_cast<VoAACEncoderListener *>(mEncoderListener);
+        if (needEncode) {
+            if (mPrerollGuardBytes >= 0) {
+                // Keep the aac frames covering the pre-roll, plus one for
+                // the encoder delay
+                int aacFrameBytes = 1024*mChannels*mBitsPerSample/8;
+                int dropSize = mPrerollCache->trim((mPrerollBytes + aacFrameBytes - 1)/aacFrameBytes + 1);
+                VadRecorderCounters::add(mCounters->cacheOverwriteBytes, dropSize);
             }
+            uint64_t start = VadRecorderCounters::threadCpuTimeNs();
+            int cacheSize = mPrerollCache->flush(mRecorderListener);
+            if (cacheSize > 0) {
+                vadtrace_segment(VADTRACE_PREROLL_FLUSH, cacheSize, 1);
+                VadRecorderCounters::add(mCounters->outputListenerTimeNs,
+                                         VadRecorderCounters::threadCpuTimeNs() - start);
+                VadRecorderCounters::add(mCounters->encodedBytes, cacheSize);
+                VadRecorderCounters::add(mCounters->prerollBytes, cacheSize);
+            }
+            listener->setHoldingCache(NULL);
+        } else {
+            listener->setHoldingCache(mPrerollCache);
         }
-        pr_dbg("Encode intput buffer: size:%d", inLength);
-        return mEncoderHandle->encode(inBuffer, inLength) == IAudioEncoder::ENCODER_NOERROR;
+        return encodeBuffer(buffer, length);
+    }
+
+    if (needEncode) {
+        bool flushed = flushCache();
+        return encodeBuffer(buffer, length) && flushed;
     } else {
-        lockfree_ringbuf_unsafe_overwrite(mCacheRingbuf, inBuffer, inLength);
+        int overwriteSize = lockfree_ringbuf_bytes_filled(mCacheRingbuf) + length - mCacheBytes;
+        if (overwriteSize > 0)
+            VadRecorderCounters::add(mCounters->cacheOverwriteBytes, overwriteSize);
+        lockfree_ringbuf_unsafe_overwrite(mCacheRingbuf, buffer, length);
         return true;
     }
 }
 
+bool VadRecorder::flushCache()
+{
+    char *buf1, *buf2;
+    int len1, len2;
+    bool ret = true;
+    int cacheSize = lockfree_ringbuf_bytes_filled(mCacheRingbuf);
+    if (cacheSize <= 0)
+        return true;
+    // Only the newest mPrerollBytes are needed
+    if (cacheSize > mPrerollBytes) {
+        VadRecorderCounters::add(mCounters->cacheOverwriteBytes, cacheSize - mPrerollBytes);
+        lockfree_ringbuf_consume(mCacheRingbuf, cacheSize - mPrerollBytes);
+    }
+    // Encode straight from the ringbuf, no staging copy
+    cacheSize = lockfree_ringbuf_peek(mCacheRingbuf, &buf1, &len1, &buf2, &len2);
+    if (cacheSize <= 0)
+        return true;
+    vadtrace_segment(VADTRACE_PREROLL_FLUSH, cacheSize, 0);
+    VadRecorderCounters::add(mCounters->prerollBytes, cacheSize);
+    // The cache is consumed even on failure, it is already counted as dropped
+    if (len1 > 0)
+        ret = encodeBuffer(buf1, len1);
+    if (len2 > 0)
+        ret = encodeBuffer(buf2, len2) && ret;
+    lockfree_ringbuf_consume(mCacheRingbuf, cacheSize);
+    return ret;
+}
+
+bool VadRecorder::encodeBuffer(char *buffer, int length)
+{
+    if (mEncodeThread == NULL)
+        return runEncoder(buffer, length);
+
+    if (lockfree_ringbuf_write(mEncodeRingbuf, buffer, length) != length) {
+        pr_err("Encode queue overflow, drop %d bytes", length);
+        vadtrace_segment(VADTRACE_QUEUE_DROP, length, 0);
+        VadRecorderCounters::add(mCounters->encodeDropBytes, length);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mEncodeLock);
+        mEncodePending = true;
+    }
+    mEncodeCond.notify_one();
+    return true;
+}
+
+bool VadRecorder::runEncoder(char *buffer, int length)
+{
+    // Listener is called from inside encode(), its time is accounted apart
+    uint64_t listenerTime = VadRecorderCounters::get(mCounters->outputListenerTimeNs);
+    uint64_t start = VadRecorderCounters::threadCpuTimeNs();
+    vadtrace_stage(VADTRACE_ENCODE_BEGIN, length, 0);
+    int ret = mEncoderHandle->encode(buffer, length);
+    vadtrace_stage(VADTRACE_ENCODE_END, ret, 0);
+    uint64_t elapsed = VadRecorderCounters::threadCpuTimeNs() - start;
+    listenerTime = VadRecorderCounters::get(mCounters->outputListenerTimeNs) - listenerTime;
+    VadRecorderCounters::add(mCounters->encodeTimeNs, elapsed > listenerTime ? elapsed - listenerTime : 0);
+    return ret == IAudioEncoder::ENCODER_NOERROR;
+}
+
+void VadRecorder::encodeThreadLoop()
+{
+    std::unique_lock<std::mutex> lk(mEncodeLock);
+    while (true) {
+        // Writes before a wakeup are seen once the flag is, and the flag is
+        // only cleared under the lock, so no notification is lost
+        mEncodeCond.wait(lk, [this] { return mEncodePending || mEncodeThreadExit; });
+        mEncodePending = false;
+        bool exiting = mEncodeThreadExit;
+        lk.unlock();
+        char *buf1, *buf2;
+        int len1, len2;
+        int readSize;
+        while ((readSize = lockfree_ringbuf_peek(mEncodeRingbuf, &buf1, &len1, &buf2, &len2)) > 0) {
+            if ((len1 > 0 && !runEncoder(buf1, len1)) || (len2 > 0 && !runEncoder(buf2, len2)))
+                pr_err("Failed to encode buffer: size:%d", readSize);
+            lockfree_ringbuf_consume(mEncodeRingbuf, readSize);
+        }
+        // Pending data is encoded before exit
+        if (exiting)
+            break;
+        lk.lock();
+    }
+}
+
+void VadRecorder::stopEncodeThread()
+{
+    if (mEncodeThread == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(mEncodeLock);
+        mEncodeThreadExit = true;
+    }
+    mEncodeCond.notify_one();
+    mEncodeThread->join();
+    delete mEncodeThread;
+    mEncodeThread = NULL;
+}
+
 bool VadRecorder::feed(char *inBuffer, int inLength)
 {
-    pr_dbg("Feed input buffer:%p, size:%d", inBuffer, inLength);
+    vadtrace_stage(VADTRACE_FEED, inLength, 0);
     if (!mInited) {
         pr_err("VadRecorder not inited");
         return false;
@@ -218,18 +684,17 @@ bool VadRecorder::feed(char *inBuffer, int inLength)
         return false;
     }
 
-    int frameCountPer10Ms = mSampleRate/100;
-    int frameBytesPer10Ms = frameCountPer10Ms*mChannels*mBitsPerSample/8;
+    int frameBytes = mFrameBytes;
 
     if (mInputBufferRemain > 0) {
-        if (mInputBufferSize >= frameBytesPer10Ms && frameBytesPer10Ms > mInputBufferRemain) {
-            int filledSize = frameBytesPer10Ms-mInputBufferRemain;
+        if (mInputBufferSize >= frameBytes && frameBytes > mInputBufferRemain) {
+            int filledSize = frameBytes-mInputBufferRemain;
             if (filledSize <= inLength) {
                 memcpy(&mInputBuffer[mInputBufferRemain], inBuffer, filledSize);
                 inBuffer += filledSize;
                 inLength -= filledSize;
                 mInputBufferRemain = 0;
-                if (!process(mInputBuffer, frameBytesPer10Ms))
+                if (!process(mInputBuffer, 1))
                     return false;
             }
         } else {
@@ -239,13 +704,14 @@ bool VadRecorder::feed(char *inBuffer, int inLength)
         }
     }
 
-    while (inLength >= frameBytesPer10Ms) {
-        if (!process(inBuffer, frameBytesPer10Ms)) {
+    int frameCount = inLength/frameBytes;
+    if (frameCount > 0) {
+        if (!process(inBuffer, frameCount)) {
             mInputBufferRemain = 0;
             return false;
         }
-        inBuffer += frameBytesPer10Ms;
-        inLength -= frameBytesPer10Ms;
+        inBuffer += frameCount*frameBytes;
+        inLength -= frameCount*frameBytes;
     }
 
     if (inLength+mInputBufferRemain <= mInputBufferSize) {
@@ -264,22 +730,210 @@ void VadRecorder::deinit()
 {
     pr_dbg("Deinit VadRecorder");
     if (mInited) {
+        release();
+        mInited = false;
+    }
+}
+
+// Frees all that init() set up, also what a failed init() left behind, so
+// that nothing of it outlives the config it was made for
+void VadRecorder::release()
+{
+    // pending data is encoded before the encoder thread exits
+    stopEncodeThread();
+    if (mVadHandle != NULL) {
         litevad_destroy(mVadHandle);
         mVadHandle = NULL;
-        delete [] mVadMonoBuffer;
-        mVadMonoBuffer = NULL;
+    }
+    delete [] mVadMonoBuffer;
+    mVadMonoBuffer = NULL;
+    delete [] mVadConvertBuffer;
+    mVadConvertBuffer = NULL;
+    delete mVadResampler;
+    mVadResampler = NULL;
+    delete [] mVadResampleBuffer;
+    mVadResampleBuffer = NULL;
+    if (mEncoderHandle != NULL) {
         mEncoderHandle->deinit();
         delete mEncoderHandle;
         mEncoderHandle = NULL;
-        delete mEncoderListener;
-        mEncoderListener = NULL;
-        delete [] mInputBuffer;
-        mInputBuffer = NULL;
-        delete [] mCacheBuffer;
-        mCacheBuffer = NULL;
-        lockfree_ringbuf_destroy(mCacheRingbuf);
-        mCacheRingbuf = NULL;
-        mInited = false;
     }
+    delete mEncoderListener;
+    mEncoderListener = NULL;
+    delete [] mInputBuffer;
+    mInputBuffer = NULL;
+    lockfree_ringbuf_destroy(mCacheRingbuf);
+    mCacheRingbuf = NULL;
+    delete mPrerollCache;
+    mPrerollCache = NULL;
+    lockfree_ringbuf_destroy(mEncodeRingbuf);
+    mEncodeRingbuf = NULL;
+}
+
+
+VadRecorderStats VadRecorder::getStats() const
+{
+    VadRecorderStats stats;
+    stats.framesProcessed = VadRecorderCounters::get(mCounters->framesProcessed);
+    stats.speechFrames = VadRecorderCounters::get(mCounters->speechFrames);
+    stats.silenceFrames = VadRecorderCounters::get(mCounters->silenceFrames);
+    stats.segments = VadRecorderCounters::get(mCounters->segments);
+    stats.prerollBytes = VadRecorderCounters::get(mCounters->prerollBytes);
+    stats.cacheOverwriteBytes = VadRecorderCounters::get(mCounters->cacheOverwriteBytes);
+    stats.encodeDropBytes = VadRecorderCounters::get(mCounters->encodeDropBytes);
+    stats.encodedBytes = VadRecorderCounters::get(mCounters->encodedBytes);
+    stats.vadTimeNs = VadRecorderCounters::get(mCounters->vadTimeNs);
+    stats.encodeTimeNs = VadRecorderCounters::get(mCounters->encodeTimeNs);
+    stats.listenerTimeNs = VadRecorderCounters::get(mCounters->eventListenerTimeNs) +
+                           VadRecorderCounters::get(mCounters->outputListenerTimeNs);
+    return stats;
+}
+
+int VadRecorder::getNoiseProfile(char *buffer, int length)
+{
+    if (!mInited) {
+        pr_err("VadRecorder not inited");
+        return -1;
+    }
+    return litevad_get_noise_profile(mVadHandle, buffer, length);
 }
 
+bool VadRecorder::serialize(std::string &state)
+{
+    if (!mInited) {
+        pr_err("VadRecorder not inited");
+        return false;
+    }
+
+    VadRecorderState header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kStateMagic;
+    header.version = kStateVersion;
+    header.frameTimeMs = (uint16_t)mFrameTimeMs;
+    header.sampleRate = mSampleRate;
+    header.channels = (int16_t)mChannels;
+    header.bitsPerSample = (int16_t)mBitsPerSample;
+    header.compressedPreroll = mPrerollCache != NULL;
+    header.speechDetected = mSpeechDetected;
+    header.speechMarginMsVal = mSpeechMarginMsVal;
+    header.prerollBytes = mPrerollBytes;
+    header.vadSamples = mVadSamples;
+    header.inputBytes = mInputBufferRemain;
+
+    std::string cache;
+    if (mPrerollCache != NULL) {
+        mPrerollCache->save(cache);
+    } else {
+        char *buf1, *buf2;
+        int len1, len2;
+        lockfree_ringbuf_peek(mCacheRingbuf, &buf1, &len1, &buf2, &len2);
+        if (len1 > 0)
+            cache.append(buf1, len1);
+        if (len2 > 0)
+            cache.append(buf2, len2);
+    }
+    header.cacheBytes = cache.size();
+    header.resamplerBytes = mVadResampler != NULL ? mVadResampler->StateSize() : 0;
+    header.vadBytes = litevad_serialize(mVadHandle, NULL, 0);
+
+    state.resize(sizeof(header) + header.inputBytes + header.cacheBytes +
+                 header.resamplerBytes + header.vadBytes);
+    char *dst = &state[0];
+    memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+    memcpy(dst, mInputBuffer, header.inputBytes);
+    dst += header.inputBytes;
+    memcpy(dst, cache.data(), header.cacheBytes);
+    dst += header.cacheBytes;
+    if (mVadResampler != NULL && mVadResampler->SaveState(dst, header.resamplerBytes) != 0) {
+        pr_err("Failed to save resampler state");
+        return false;
+    }
+    dst += header.resamplerBytes;
+    if (litevad_serialize(mVadHandle, dst, header.vadBytes) != header.vadBytes) {
+        pr_err("Failed to save vad state");
+        return false;
+    }
+    return true;
+}
+
+bool VadRecorder::deserialize(const char *state, int length)
+{
+    if (!mInited) {
+        pr_err("VadRecorder not inited");
+        return false;
+    }
+
+    VadRecorderState header;
+    if (state == NULL || length < (int)sizeof(header)) {
+        pr_err("Invalid state length: %d", length);
+        return false;
+    }
+    memcpy(&header, state, sizeof(header));
+    if (header.magic != kStateMagic || header.version != kStateVersion) {
+        pr_err("Invalid state");
+        return false;
+    }
+    if (header.sampleRate != mSampleRate || header.channels != mChannels ||
+        header.bitsPerSample != mBitsPerSample || header.frameTimeMs != mFrameTimeMs ||
+        header.compressedPreroll != (mPrerollCache != NULL)) {
+        pr_err("State of %dHz/%dCh/%dBits/%dms, recorder inited with other settings",
+               header.sampleRate, header.channels, header.bitsPerSample, header.frameTimeMs);
+        return false;
+    }
+    if (header.inputBytes < 0 || header.inputBytes >= mInputBufferSize ||
+        header.cacheBytes < 0 || header.resamplerBytes < 0 || header.vadBytes < 0 ||
+        length != (int)sizeof(header) + header.inputBytes + header.cacheBytes +
+                  header.resamplerBytes + header.vadBytes) {
+        pr_err("Invalid state length: %d", length);
+        return false;
+    }
+    if (header.resamplerBytes != (mVadResampler != NULL ? (int)mVadResampler->StateSize() : 0) ||
+        (mPrerollCache == NULL && header.cacheBytes > mCacheBytes)) {
+        pr_err("Invalid state");
+        return false;
+    }
+
+    const char *input = state + sizeof(header);
+    const char *cache = input + header.inputBytes;
+    const char *resampler = cache + header.cacheBytes;
+    const char *vad = resampler + header.resamplerBytes;
+    // litevad and resampler check their own state, restore them first and
+    // roll litevad back if the resampler fails, so that nothing is changed
+    std::string vadBackup(litevad_serialize(mVadHandle, NULL, 0), '\0');
+    litevad_serialize(mVadHandle, &vadBackup[0], vadBackup.size());
+    if (litevad_deserialize(mVadHandle, vad, header.vadBytes) != 0) {
+        pr_err("Failed to restore vad state");
+        return false;
+    }
+    if (mVadResampler != NULL && mVadResampler->RestoreState(resampler, header.resamplerBytes) != 0) {
+        pr_err("Failed to restore resampler state");
+        litevad_deserialize(mVadHandle, vadBackup.data(), vadBackup.size());
+        return false;
+    }
+
+    if (mPrerollCache != NULL) {
+        mPrerollCache->reset();
+        mPrerollCache->write(const_cast<char *>(cache), header.cacheBytes);
+    } else {
+        lockfree_ringbuf_unsafe_reset(mCacheRingbuf);
+        lockfree_ringbuf_write(mCacheRingbuf, const_cast<char *>(cache), header.cacheBytes);
+    }
+    memcpy(mInputBuffer, input, header.inputBytes);
+    mInputBufferRemain = header.inputBytes;
+    mSpeechDetected = header.speechDetected != 0;
+    mSpeechMarginMsVal = header.speechMarginMsVal;
+    mPrerollBytes = header.prerollBytes;
+    mVadSamples = header.vadSamples;
+    return true;
+}
+
+bool VadRecorder::startTrace(const char *path)
+{
+    return vadtrace_start(path) == 0;
+}
+
+void VadRecorder::stopTrace()
+{
+    vadtrace_stop();
+}
@@ -0,0 +1,75 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef __VADRECORDERCOUNTERS_H
+#define __VADRECORDERCOUNTERS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+// Live counters behind VadRecorderStats. In async mode some counters are
+// written by both the feeding thread and the encoder thread, so updates are
+// relaxed atomic adds: no increment is lost, and readers on other threads
+// only see slightly stale values.
+struct VadRecorderCounters {
+    std::atomic<uint64_t> framesProcessed;
+    std::atomic<uint64_t> speechFrames;
+    std::atomic<uint64_t> silenceFrames;
+    std::atomic<uint64_t> segments;
+    std::atomic<uint64_t> prerollBytes;
+    std::atomic<uint64_t> cacheOverwriteBytes;
+    std::atomic<uint64_t> encodeDropBytes;
+    std::atomic<uint64_t> encodedBytes;
+    std::atomic<uint64_t> vadTimeNs;
+    std::atomic<uint64_t> encodeTimeNs;
+    std::atomic<uint64_t> eventListenerTimeNs;
+    std::atomic<uint64_t> outputListenerTimeNs;
+
+    VadRecorderCounters() { reset(); }
+
+    void reset() {
+        framesProcessed = 0;
+        speechFrames = 0;
+        silenceFrames = 0;
+        segments = 0;
+        prerollBytes = 0;
+        cacheOverwriteBytes = 0;
+        encodeDropBytes = 0;
+        encodedBytes = 0;
+        vadTimeNs = 0;
+        encodeTimeNs = 0;
+        eventListenerTimeNs = 0;
+        outputListenerTimeNs = 0;
+    }
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t value) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static uint64_t get(const std::atomic<uint64_t> &counter) {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    // CPU time of calling thread, time spent off-cpu is not counted
+    static uint64_t threadCpuTimeNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+    }
+};
+
+#endif // __VADRECORDERCOUNTERS_H
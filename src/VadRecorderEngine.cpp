@@ -0,0 +1,275 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <string.h>
+#include <deque>
+#include <thread>
+#include "logger.h"
+#include "lockfree_ringbuf.h"
+#include "vadtrace.h"
+#include "VadRecorderEngine.hpp"
+
+#define TAG "VadRecorderEngine"
+
+// Max bytes a worker processes for one stream before rescheduling it, so
+// that a stream with a long backlog can't starve the others
+static const int kMaxBytesPerTurn = 32*1024;
+
+struct VadRecorderEngine::Stream : public std::enable_shared_from_this<Stream> {
+    VadRecorder *recorder;
+    void *queue;              // pending pcm, written by feeder, read by worker
+    std::atomic<bool> scheduled;
+    std::mutex lock;          // serializes processing and destroying
+    bool closed;
+    int homeWorker;
+
+    Stream() : recorder(NULL), queue(NULL), scheduled(false), closed(false), homeWorker(0) {}
+    ~Stream() {
+        if (queue != NULL)
+            lockfree_ringbuf_destroy(queue);
+    }
+};
+
+struct VadRecorderEngine::Worker {
+    std::thread thread;
+    std::mutex lock;
+    std::deque<std::shared_ptr<Stream> > tasks;
+};
+
+VadRecorderEngine::VadRecorderEngine()
+    : mInited(false),
+      mRunning(false),
+      mPendingTasks(0),
+      mSleepingWorkers(0),
+      mNextWorker(0)
+{}
+
+VadRecorderEngine::~VadRecorderEngine()
+{
+    deinit();
+}
+
+bool VadRecorderEngine::init(int workerCount)
+{
+    if (mInited) {
+        pr_wrn("Reconfig VadRecorderEngine");
+        deinit();
+    }
+
+    if (workerCount <= 0)
+        workerCount = (int)std::thread::hardware_concurrency();
+    if (workerCount <= 0)
+        workerCount = 1;
+    pr_dbg("Init VadRecorderEngine: %d workers", workerCount);
+
+    mRunning = true;
+    mPendingTasks = 0;
+    mSleepingWorkers = 0;
+    for (int i = 0; i < workerCount; i++)
+        mWorkers.push_back(new Worker());
+    for (int i = 0; i < workerCount; i++)
+        mWorkers[i]->thread = std::thread(&VadRecorderEngine::workerLoop, this, i);
+
+    mInited = true;
+    return mInited;
+}
+
+VadRecorderEngine::StreamHandle VadRecorderEngine::createStream(VadRecorder *recorder, int queueSize)
+{
+    if (!mInited) {
+        pr_err("VadRecorderEngine not inited");
+        return NULL;
+    }
+
+    if (recorder == NULL || queueSize <= 0) {
+        pr_err("Invalid recorder or queue size");
+        return NULL;
+    }
+
+    std::shared_ptr<Stream> stream = std::make_shared<Stream>();
+    stream->queue = lockfree_ringbuf_create(queueSize);
+    if (stream->queue == NULL) {
+        pr_err("Failed to allocate stream queue");
+        return NULL;
+    }
+    stream->recorder = recorder;
+    stream->homeWorker = (int)(mNextWorker++ % mWorkers.size());
+
+    std::lock_guard<std::mutex> lk(mStreamsLock);
+    mStreams.insert(stream);
+    return (StreamHandle)stream.get();
+}
+
+bool VadRecorderEngine::feed(StreamHandle handle, char *inBuffer, int inLength)
+{
+    Stream *stream = (Stream *)handle;
+    if (!mInited || stream == NULL) {
+        pr_err("VadRecorderEngine not inited or invalid stream");
+        return false;
+    }
+
+    if (inBuffer == NULL || inLength <= 0) {
+        pr_err("Invalid input buffer or input length");
+        return false;
+    }
+
+    if (lockfree_ringbuf_write(stream->queue, inBuffer, inLength) != inLength) {
+        pr_err("Stream queue overflow, drop %d bytes", inLength);
+        return false;
+    }
+
+    if (!stream->scheduled.exchange(true))
+        schedule(stream->shared_from_this(), stream->homeWorker);
+    return true;
+}
+
+void VadRecorderEngine::destroyStream(StreamHandle handle)
+{
+    Stream *stream = (Stream *)handle;
+    if (stream == NULL)
+        return;
+
+    std::shared_ptr<Stream> holder = stream->shared_from_this();
+    {
+        std::lock_guard<std::mutex> lk(mStreamsLock);
+        mStreams.erase(holder);
+    }
+
+    // Drain the queue on the caller's thread, workers skip the stream once
+    // it's closed, the memory is released by whoever drops the last reference
+    std::lock_guard<std::mutex> lk(stream->lock);
+    char *buf1, *buf2;
+    int len1, len2;
+    int readSize = lockfree_ringbuf_peek(stream->queue, &buf1, &len1, &buf2, &len2);
+    if (len1 > 0)
+        stream->recorder->feed(buf1, len1);
+    if (len2 > 0)
+        stream->recorder->feed(buf2, len2);
+    lockfree_ringbuf_consume(stream->queue, readSize);
+    stream->closed = true;
+}
+
+void VadRecorderEngine::deinit()
+{
+    if (!mInited)
+        return;
+    pr_dbg("Deinit VadRecorderEngine");
+
+    {
+        std::lock_guard<std::mutex> lk(mIdleLock);
+        mRunning = false;
+    }
+    mIdleCond.notify_all();
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->thread.join();
+        delete mWorkers[i];
+    }
+    mWorkers.clear();
+
+    std::lock_guard<std::mutex> lk(mStreamsLock);
+    if (!mStreams.empty())
+        pr_wrn("%d streams not destroyed", (int)mStreams.size());
+    mStreams.clear();
+    mInited = false;
+}
+
+void VadRecorderEngine::schedule(const std::shared_ptr<Stream> &stream, int workerIndex)
+{
+    Worker *worker = mWorkers[workerIndex];
+    {
+        std::lock_guard<std::mutex> lk(worker->lock);
+        worker->tasks.push_back(stream);
+    }
+    mPendingTasks++;
+    if (mSleepingWorkers > 0) {
+        std::lock_guard<std::mutex> lk(mIdleLock);
+        mIdleCond.notify_one();
+    }
+}
+
+std::shared_ptr<VadRecorderEngine::Stream> VadRecorderEngine::pickTask(int workerIndex)
+{
+    std::shared_ptr<Stream> stream;
+    int workerCount = (int)mWorkers.size();
+
+    // Own queue first, oldest task first
+    Worker *self = mWorkers[workerIndex];
+    {
+        std::lock_guard<std::mutex> lk(self->lock);
+        if (!self->tasks.empty()) {
+            stream = self->tasks.front();
+            self->tasks.pop_front();
+            return stream;
+        }
+    }
+
+    // Then steal the newest task of the other workers
+    for (int i = 1; i < workerCount; i++) {
+        Worker *victim = mWorkers[(workerIndex + i) % workerCount];
+        std::lock_guard<std::mutex> lk(victim->lock);
+        if (!victim->tasks.empty()) {
+            stream = victim->tasks.back();
+            victim->tasks.pop_back();
+            return stream;
+        }
+    }
+    return stream;
+}
+
+void VadRecorderEngine::processStream(const std::shared_ptr<Stream> &stream, int workerIndex)
+{
+    {
+        std::lock_guard<std::mutex> lk(stream->lock);
+        if (stream->closed) {
+            stream->scheduled = false;
+            return;
+        }
+        // Feed the recorder straight from the queue
+        char *buf1, *buf2;
+        int len1, len2;
+        lockfree_ringbuf_peek(stream->queue, &buf1, &len1, &buf2, &len2);
+        len1 = len1 > kMaxBytesPerTurn ? kMaxBytesPerTurn : len1;
+        len2 = len2 > kMaxBytesPerTurn - len1 ? kMaxBytesPerTurn - len1 : len2;
+        vadtrace_stage(VADTRACE_ENGINE_TURN, len1 + len2, workerIndex);
+        if ((len1 > 0 && !stream->recorder->feed(buf1, len1)) ||
+            (len2 > 0 && !stream->recorder->feed(buf2, len2)))
+            pr_err("Failed to feed pcm data to VadRecorder");
+        lockfree_ringbuf_consume(stream->queue, len1 + len2);
+    }
+
+    // Clear the flag before checking the queue again, so that data enqueued
+    // meanwhile is either seen here or reschedules the stream in feed()
+    stream->scheduled = false;
+    if (lockfree_ringbuf_bytes_filled(stream->queue) > 0 && !stream->scheduled.exchange(true))
+        schedule(stream, workerIndex);
+}
+
+void VadRecorderEngine::workerLoop(int workerIndex)
+{
+    while (mRunning) {
+        std::shared_ptr<Stream> stream = pickTask(workerIndex);
+        if (stream) {
+            mPendingTasks--;
+            processStream(stream, workerIndex);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lk(mIdleLock);
+        mSleepingWorkers++;
+        mIdleCond.wait(lk, [this] { return mPendingTasks > 0 || !mRunning; });
+        mSleepingWorkers--;
+    }
+}
@@ -0,0 +1,416 @@
+/*
+ ** Copyright 2023-, Qinglong<sysu.zqlong@gmail.com>.
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "logger.h"
+#include "IAudioEncoder.hpp"
+#include "VoAACEncoder.hpp"
+#include "VadRecorder.hpp"
+#include "VadRecorderCounters.hpp"
+#include "vadtrace.h"
+
+#define TAG "VadRecorderOffline"
+
+// Bytes given to feed() at a time in single thread mode
+static const int kFeedChunkSize = 4*1024*1024;
+// Longer speech is split into segments of this length, so that it's encoded
+// in parallel and its output doesn't pile up in memory
+static const int kMaxSegmentTimeInMs = 30*1000;
+// Samples per aac frame, segment tail is padded to it with silence
+static const int kAacFrameSamples = 1024;
+
+static const int kWavFormatPcm = 1;
+static const int kWavFormatFloat = 3;
+static const int kWavFormatExtensible = 0xFFFE;
+
+struct WavInfo {
+    int format;
+    int channels;
+    int sampleRate;
+    int bitsPerSample;
+    const char *data;
+    size_t dataLength;
+};
+
+// A run of frames to encode, with the pre-roll before it
+struct Segment {
+    size_t begin;                               // pre-roll included
+    size_t end;
+    std::vector<std::pair<size_t, int> > events;  // frame position, frame flags
+    std::vector<std::pair<size_t, int> > marks;   // output offset, frame flags
+    std::string output;
+    uint64_t encodeTimeNs;
+    bool done;
+    bool failed;
+
+    Segment(size_t b) : begin(b), end(b), encodeTimeNs(0), done(false), failed(false) {}
+};
+
+class SegmentOutput : public IAudioEncoderListener
+{
+public:
+    SegmentOutput(std::string *output) : mOutput(output) {}
+    void onOutputBufferAvailable(char *outBuffer, int outLength) {
+        mOutput->append(outBuffer, outLength);
+    }
+private:
+    std::string *mOutput;
+};
+
+static unsigned int readLe16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8);
+}
+
+static unsigned int readLe32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+static bool parseWav(const char *file, size_t fileSize, WavInfo *info)
+{
+    if (fileSize < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0)
+        return false;
+
+    bool fmtFound = false;
+    size_t pos = 12;
+    while (pos + 8 <= fileSize) {
+        const char *chunk = file + pos;
+        size_t chunkSize = readLe32(chunk + 4);
+        pos += 8;
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunkSize < 16 || chunkSize > fileSize - pos)
+                return false;
+            info->format = readLe16(file + pos);
+            info->channels = readLe16(file + pos + 2);
+            info->sampleRate = readLe32(file + pos + 4);
+            info->bitsPerSample = readLe16(file + pos + 14);
+            // Extensible format keeps the actual one in the sub-format guid
+            if (info->format == kWavFormatExtensible && chunkSize >= 40)
+                info->format = readLe16(file + pos + 24);
+            fmtFound = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!fmtFound)
+                return false;
+            // Length in header is unreliable for files written while recording
+            if (chunkSize > fileSize - pos)
+                chunkSize = fileSize - pos;
+            info->data = file + pos;
+            info->dataLength = chunkSize;
+            return true;
+        }
+        pos += chunkSize + (chunkSize & 1);
+    }
+    return false;
+}
+
+static IAudioEncoder *createEncoder(VadRecorder::EncoderType encoderType)
+{
+    switch (encoderType) {
+    case VadRecorder::ENCODER_AAC:
+        return new VoAACEncoder();
+    default:
+        return NULL;
+    }
+}
+
+static bool wavSampleFormat(const WavInfo &wav, IAudioEncoder::SampleFormat *format)
+{
+    if (wav.format == kWavFormatPcm || wav.format == kWavFormatExtensible) {
+        switch (wav.bitsPerSample) {
+        case 16: *format = IAudioEncoder::SAMPLE_FORMAT_S16; return true;
+        case 24: *format = IAudioEncoder::SAMPLE_FORMAT_S24_3LE; return true;
+        case 32: *format = IAudioEncoder::SAMPLE_FORMAT_S32; return true;
+        default: return false;
+        }
+    }
+    if (wav.format == kWavFormatFloat && wav.bitsPerSample == 32) {
+        *format = IAudioEncoder::SAMPLE_FORMAT_F32;
+        return true;
+    }
+    return false;
+}
+
+static void encodeSegment(Segment *seg, const char *data, VadRecorder::EncoderType encoderType,
+                          int sampleRate, int channels, int bitsPerSample,
+                          IAudioEncoder::SampleFormat sampleFormat)
+{
+    uint64_t start = VadRecorderCounters::threadCpuTimeNs();
+    vadtrace_stage(VADTRACE_ENCODE_BEGIN, seg->end - seg->begin, 0);
+    SegmentOutput output(&seg->output);
+    IAudioEncoder *encoder = createEncoder(encoderType);
+    if (encoder == NULL ||
+        encoder->init(&output, sampleRate, channels, bitsPerSample, sampleFormat) != IAudioEncoder::ENCODER_NOERROR) {
+        pr_err("Failed to init audio encoder");
+        seg->failed = true;
+        delete encoder;
+        return;
+    }
+
+    // Encode up to each event, so that it's output at the same place as in
+    // streaming mode
+    size_t pos = seg->begin;
+    for (size_t i = 0; i < seg->events.size() && !seg->failed; i++) {
+        size_t eventPos = seg->events[i].first;
+        if (eventPos > pos) {
+            if (encoder->encode((char *)&data[pos], eventPos - pos) != IAudioEncoder::ENCODER_NOERROR)
+                seg->failed = true;
+            pos = eventPos;
+        }
+        seg->marks.push_back(std::make_pair(seg->output.size(), seg->events[i].second));
+    }
+    if (!seg->failed && seg->end > pos &&
+        encoder->encode((char *)&data[pos], seg->end - pos) != IAudioEncoder::ENCODER_NOERROR)
+        seg->failed = true;
+
+    // Pad the last partial aac frame, it would stay in encoder otherwise
+    int aacFrameBytes = kAacFrameSamples*channels*bitsPerSample/8;
+    int tailBytes = (seg->end - seg->begin) % aacFrameBytes;
+    if (!seg->failed && tailBytes > 0) {
+        std::vector<char> silence(aacFrameBytes - tailBytes, 0);
+        if (encoder->encode(&silence[0], silence.size()) != IAudioEncoder::ENCODER_NOERROR)
+            seg->failed = true;
+    }
+    if (seg->failed)
+        pr_err("Failed to encode segment: [%zu, %zu)", seg->begin, seg->end);
+
+    encoder->deinit();
+    delete encoder;
+    vadtrace_stage(VADTRACE_ENCODE_END, seg->failed ? -1 : 0, 0);
+    seg->encodeTimeNs = VadRecorderCounters::threadCpuTimeNs() - start;
+}
+
+bool VadRecorder::processFile(VadRecorderListener *listener, const char *path,
+                              int threadCount, EncoderType encoderType)
+{
+    if (path == NULL) {
+        pr_err("Invalid file path");
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        pr_err("Failed to open %s", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        pr_err("Failed to stat %s", path);
+        close(fd);
+        return false;
+    }
+    size_t fileSize = st.st_size;
+    char *file = (char *)mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        pr_err("Failed to mmap %s", path);
+        return false;
+    }
+    madvise(file, fileSize, MADV_SEQUENTIAL);
+
+    WavInfo wav;
+    IAudioEncoder::SampleFormat sampleFormat;
+    bool ret = parseWav(file, fileSize, &wav);
+    if (!ret) {
+        pr_err("Invalid wav file %s", path);
+    } else if (!wavSampleFormat(wav, &sampleFormat)) {
+        pr_err("Unsupported wav format %d, sample depth %d", wav.format, wav.bitsPerSample);
+        ret = false;
+    } else {
+        mSampleFormat = sampleFormat;
+        ret = init(listener, wav.sampleRate, wav.channels, wav.bitsPerSample, encoderType);
+    }
+
+    if (ret) {
+        if (threadCount <= 0)
+            threadCount = (int)std::thread::hardware_concurrency();
+        if (threadCount <= 1) {
+            // Same path as streaming mode, output matches it byte for byte
+            for (size_t pos = 0; ret && pos < wav.dataLength; pos += kFeedChunkSize) {
+                size_t length = wav.dataLength - pos;
+                ret = feed((char *)&wav.data[pos], length > (size_t)kFeedChunkSize ? kFeedChunkSize : length);
+            }
+        } else {
+            ret = processSegments(wav.data, wav.dataLength, threadCount);
+        }
+        deinit();
+    }
+
+    munmap(file, fileSize);
+    return ret;
+}
+
+bool VadRecorder::processSegments(const char *data, size_t dataLength, int threadCount)
+{
+    std::vector<Segment *> segments;
+    std::mutex lock;
+    std::condition_variable cond;
+    size_t nextSegment = 0;
+    bool vadDone = false;
+
+    // Workers encode segments as soon as VAD closes them
+    EncoderType encoderType = mEncoderType;
+    int sampleRate = mSampleRate, channels = mChannels, bitsPerSample = mBitsPerSample;
+    IAudioEncoder::SampleFormat sampleFormat = mSampleFormat;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadCount; i++) {
+        workers.push_back(std::thread([&, encoderType, sampleRate, channels, bitsPerSample, sampleFormat]() {
+            std::unique_lock<std::mutex> lk(lock);
+            while (true) {
+                cond.wait(lk, [&] { return nextSegment < segments.size() || vadDone; });
+                if (nextSegment >= segments.size())
+                    break;
+                Segment *seg = segments[nextSegment++];
+                lk.unlock();
+                encodeSegment(seg, data, encoderType, sampleRate, channels, bitsPerSample, sampleFormat);
+                lk.lock();
+                seg->done = true;
+                cond.notify_all();
+            }
+        }));
+    }
+
+    bool ret = true;
+
+    // Output in file order, events at their place in the encoded data. Done
+    // segments are output and freed while VAD goes on, wait for the rest.
+    size_t nextOutput = 0;
+    uint64_t outputTimeNs = 0;
+    auto outputSegments = [&](bool wait) {
+        while (true) {
+            Segment *s;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                if (nextOutput >= segments.size())
+                    return;
+                s = segments[nextOutput];
+                if (!s->done && !wait)
+                    return;
+                cond.wait(lk, [s] { return s->done; });
+                segments[nextOutput++] = NULL;
+            }
+            if (s->failed)
+                ret = false;
+            VadRecorderCounters::add(mCounters->encodeTimeNs, s->encodeTimeNs);
+            VadRecorderCounters::add(mCounters->encodedBytes, s->output.size());
+            uint64_t listenerStart = VadRecorderCounters::threadCpuTimeNs();
+            size_t offset = 0;
+            for (size_t j = 0; j < s->marks.size(); j++) {
+                size_t markOffset = s->marks[j].first;
+                if (markOffset > offset)
+                    mRecorderListener->onOutputBufferAvailable(&s->output[offset], markOffset - offset);
+                offset = markOffset;
+                notifyEvents(s->marks[j].second);
+            }
+            if (s->output.size() > offset)
+                mRecorderListener->onOutputBufferAvailable(&s->output[offset], s->output.size() - offset);
+            uint64_t listenerTimeNs = VadRecorderCounters::threadCpuTimeNs() - listenerStart;
+            VadRecorderCounters::add(mCounters->outputListenerTimeNs, listenerTimeNs);
+            outputTimeNs += listenerTimeNs;
+            delete s;
+        }
+    };
+
+    // VAD keeps state across frames, so it runs over the file in order, it's
+    // cheap compared to encoding. The segments are the frames streaming mode
+    // would encode, with the pcm pre-roll it would flush before them.
+    size_t frameCount = dataLength/mFrameBytes;
+    size_t maxSegmentBytes = (size_t)mFrameBytes*(kMaxSegmentTimeInMs/mFrameTimeMs);
+    size_t silenceBytes = 0;
+    std::vector<std::pair<size_t, int> > pendingEvents;
+    Segment *seg = NULL;
+    size_t chunkFrames = kFeedChunkSize/mFrameBytes;
+    std::vector<unsigned char> chunkFlags(chunkFrames);
+    std::vector<int> chunkPrerolls(chunkFrames);
+    uint64_t vadStart = VadRecorderCounters::threadCpuTimeNs();
+    for (size_t i = 0; i < frameCount; i++) {
+        size_t pos = i*mFrameBytes;
+        if (i % chunkFrames == 0) {
+            outputSegments(false);
+            size_t n = frameCount - i < chunkFrames ? frameCount - i : chunkFrames;
+            if (!analyzeFrames((char *)&data[pos], n, &chunkFlags[0], &chunkPrerolls[0])) {
+                ret = false;
+                break;
+            }
+        }
+        int flags = chunkFlags[i % chunkFrames];
+
+        if (flags & FRAME_ENCODE) {
+            if (seg != NULL && seg->end - seg->begin >= maxSegmentBytes) {
+                std::lock_guard<std::mutex> lk(lock);
+                segments.push_back(seg);
+                cond.notify_all();
+                seg = NULL;
+                silenceBytes = 0;
+            }
+            if (seg == NULL) {
+                size_t maxPrerollBytes = (flags & FRAME_SPEECH_BEGIN) ?
+                                         chunkPrerolls[i % chunkFrames] : mCacheBytes;
+                size_t prerollBytes = silenceBytes < maxPrerollBytes ? silenceBytes : maxPrerollBytes;
+                VadRecorderCounters::add(mCounters->prerollBytes, prerollBytes);
+                VadRecorderCounters::add(mCounters->cacheOverwriteBytes, silenceBytes - prerollBytes);
+                seg = new Segment(pos - prerollBytes);
+                // Events since last segment are notified before the pre-roll
+                for (size_t j = 0; j < pendingEvents.size(); j++)
+                    seg->events.push_back(std::make_pair(seg->begin, pendingEvents[j].second));
+                pendingEvents.clear();
+                if (flags & FRAME_EVENTS)
+                    seg->events.push_back(std::make_pair(seg->begin, flags));
+            } else if (flags & FRAME_EVENTS) {
+                seg->events.push_back(std::make_pair(pos, flags));
+            }
+            seg->end = pos + mFrameBytes;
+        } else {
+            if (seg != NULL) {
+                std::lock_guard<std::mutex> lk(lock);
+                segments.push_back(seg);
+                cond.notify_all();
+                seg = NULL;
+                silenceBytes = 0;
+            }
+            silenceBytes += mFrameBytes;
+            if (flags & FRAME_EVENTS)
+                pendingEvents.push_back(std::make_pair(pos, flags));
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        if (seg != NULL)
+            segments.push_back(seg);
+        vadDone = true;
+        cond.notify_all();
+    }
+    // Encoder and listener time of the segments are added on output
+    VadRecorderCounters::add(mCounters->vadTimeNs,
+                             VadRecorderCounters::threadCpuTimeNs() - vadStart - outputTimeNs);
+
+    outputSegments(true);
+    for (size_t j = 0; j < pendingEvents.size(); j++)
+        notifyEvents(pendingEvents[j].second);
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    return ret;
+}
@@ -20,6 +20,7 @@
 #include "logger.h"
 #include "voAAC.h"
 #include "cmnMemory.h"
+#include "pcm_convert.h"
 #include "VoAACEncoder.hpp"
 
 #define TAG "VoAACEncoder"
@@ -27,6 +28,7 @@
 VoAACEncoder::VoAACEncoder()
     : mListener(NULL)
     , mCodecHandle(NULL)
+    , mBitRate(0)
 {
     voGetAACEncAPI(&mCodecApi);
 
@@ -39,8 +41,11 @@ VoAACEncoder::VoAACEncoder()
     mOutBuffer.Length = 2*sizeof(short)*1024;
     mOutBuffer.Buffer = (VO_PBYTE)malloc(mOutBuffer.Length);
 
-    mInBuffer.Length = 2*sizeof(short)*1024;
+    // Partial frame in input format, up to 32-bit stereo
+    mInBuffer.Length = 2*sizeof(int)*1024;
     mInBuffer.Buffer = (VO_PBYTE)malloc(mInBuffer.Length);
+    mConvertBuffer = (short *)malloc(2*sizeof(short)*1024);
+    mPcmFormat = PCM_FORMAT_S16;
     mBytesRemain = 0;
 }
 
@@ -52,12 +57,15 @@ VoAACEncoder::~VoAACEncoder()
         free(mOutBuffer.Buffer);
     if (mInBuffer.Buffer != NULL)
         free(mInBuffer.Buffer);
+    if (mConvertBuffer != NULL)
+        free(mConvertBuffer);
 }
 
 int VoAACEncoder::init(IAudioEncoderListener *listener,
-                       int sampleRate, int channels, int bitsPerSample)
+                       int sampleRate, int channels, int bitsPerSample,
+                       SampleFormat sampleFormat)
 {
-    if (mOutBuffer.Buffer == NULL || mInBuffer.Buffer == NULL) {
+    if (mOutBuffer.Buffer == NULL || mInBuffer.Buffer == NULL || mConvertBuffer == NULL) {
         pr_err("Invalid in/out buffer\n");
         return ENCODER_ERROR_NULLPOINTER;
     }
@@ -72,9 +80,18 @@ int VoAACEncoder::init(IAudioEncoderListener *listener,
         return ENCODER_ERROR_BADCHANNELS;
     }
 
-    if (bitsPerSample != 16) {
-        // todo: 24/32bit convert to 16bit
-        pr_err("Unsupported pcm sample depth %d\n", bitsPerSample);
+    // Samples are converted to 16-bit frame by frame while being staged for
+    // the codec
+    int pcmFormat;
+    switch (sampleFormat) {
+    case SAMPLE_FORMAT_S16:     pcmFormat = PCM_FORMAT_S16; break;
+    case SAMPLE_FORMAT_S24_3LE: pcmFormat = PCM_FORMAT_S24_3LE; break;
+    case SAMPLE_FORMAT_S32:     pcmFormat = PCM_FORMAT_S32; break;
+    case SAMPLE_FORMAT_F32:     pcmFormat = PCM_FORMAT_F32; break;
+    default:                    pcmFormat = -1; break;
+    }
+    if (pcmFormat < 0 || bitsPerSample != pcm_format_bytes((pcm_format_t)pcmFormat)*8) {
+        pr_err("Unsupported pcm sample depth %d, format %d\n", bitsPerSample, sampleFormat);
         return ENCODER_ERROR_BADSAMPLEBITS;
     }
 
@@ -109,7 +126,10 @@ int VoAACEncoder::init(IAudioEncoderListener *listener,
     }
 
     mListener = listener;
-    mBytesFrame = channels*sizeof(short)*1024;
+    mPcmFormat = pcmFormat;
+    mSamplesFrame = channels*1024;
+    mBytesFrame = mSamplesFrame*bitsPerSample/8;
+    mBitRate = bitRate;
     return ENCODER_NOERROR;
 }
 
@@ -137,8 +157,8 @@ int VoAACEncoder::encode(char *inBuffer, int inLength)
             int bytesFilled = mBytesFrame - mBytesRemain;
             memcpy(mInBuffer.Buffer + mBytesRemain, inBuffer, bytesFilled);
 
-            inData.Buffer = mInBuffer.Buffer;
-            inData.Length = mBytesFrame;
+            inData.Buffer = frameData(mInBuffer.Buffer);
+            inData.Length = mSamplesFrame*sizeof(short);
             mCodecApi.SetInputData(mCodecHandle, &inData);
 
             outData.Buffer = mOutBuffer.Buffer;
@@ -160,8 +180,8 @@ int VoAACEncoder::encode(char *inBuffer, int inLength)
 
     mBytesRemain = inLength - bytesRead;
     while (mBytesRemain >= mBytesFrame) {
-        inData.Buffer = (VO_PBYTE)inBuffer + bytesRead;
-        inData.Length = mBytesFrame;
+        inData.Buffer = frameData((VO_PBYTE)inBuffer + bytesRead);
+        inData.Length = mSamplesFrame*sizeof(short);
         mCodecApi.SetInputData(mCodecHandle, &inData);
 
         outData.Buffer = mOutBuffer.Buffer + bytesEncoded;
@@ -185,6 +205,15 @@ int VoAACEncoder::encode(char *inBuffer, int inLength)
     return ENCODER_NOERROR;
 }
 
+// 16-bit samples of a frame in input format
+VO_PBYTE VoAACEncoder::frameData(VO_PBYTE frame)
+{
+    if (mPcmFormat == PCM_FORMAT_S16)
+        return frame;
+    pcm_convert_s16(frame, (pcm_format_t)mPcmFormat, mSamplesFrame, mConvertBuffer);
+    return (VO_PBYTE)mConvertBuffer;
+}
+
 void VoAACEncoder::deinit()
 {
     if (mCodecHandle != NULL) {
@@ -28,10 +28,13 @@ public:
     ~VoAACEncoder();
 
     int init(IAudioEncoderListener *listener,
-             int sampleRate, int channels, int bitsPerSample);
+             int sampleRate, int channels, int bitsPerSample,
+             SampleFormat sampleFormat = SAMPLE_FORMAT_S16);
 
     int encode(char *inBuffer, int inLength);
 
+    int getBitRate() { return mBitRate; }
+
     void deinit();
 
 private:
@@ -41,9 +44,14 @@ private:
     VO_HANDLE              mCodecHandle;
     VO_CODECBUFFER         mOutBuffer;
     VO_CODECBUFFER         mInBuffer;
+    short                 *mConvertBuffer;
+    int                    mPcmFormat;
     int                    mBytesRemain;
     int                    mBytesFrame;
+    int                    mSamplesFrame;
+    int                    mBitRate;
     int preferredBitRate(int sampleRate, int channels);
+    VO_PBYTE frameData(VO_PBYTE frame);
 };
 
 #endif // __VOAACENCODER_H
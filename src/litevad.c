@@ -15,12 +15,15 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
 #include "vad/webrtc_vad.h"
+#include "signal_processing/signal_processing_library.h"
 #include "litevad.h"
+#include "vadtrace.h"
 #include "logger.h"
 
 #define TAG "litevad"
@@ -44,28 +47,144 @@
 // 静音权重阈值（最大值 100，最小值 0）：
 //  1. 持续 400ms 检测到语音，认为出现有效语音数据，此时权重为 100
 //  2. 检测到 1 帧数据有语音，权重 +1；检测到 1 帧数据静音，权重 -1；值范围：0-100
-//  3. 当权重值低于 30，将触发 VAD 判停
+//  3. 当权重值低于 100 - 判停静音时长/10ms（默认 700ms 对应 30），将触发 VAD 判停，
+//     判停静音时长达到 1000ms 及以上时不再按权重判停
 // 静音权重的引入主要为了解决“片段时间内，误检测为语音而无法判停”的问题。比如说：
 // 片段时间内，出现了大量的静音数据，但又会检测到零碎的语音，我们认为这些零碎的语
 // 音是误检测的
-#define DEFAULT_EOS_SILENCE_WEIGHT 30
 
 // VAD 模式（合法值：0/1/2/3），值越大对语音的判断越严格（越准确？）
 #define DEFAULT_VAD_MODE           3
 
+// 语音预判：持续检测到语音的时长达到该值时预报语音可能开始，0 表示关闭
+#define DEFAULT_BOS_LIKELY_TIME    0
+
+// 自适应判停：静音时长在 [500ms, 1000ms] 内，按语音与噪声的似然比差距调整，
+// 差距越大（语音清晰、环境安静）判停越快，差距越小（环境嘈杂）判停越慢
+#define DEFAULT_EOS_MIN_SILENCE_TIME 500
+#define DEFAULT_EOS_MAX_SILENCE_TIME 1000
+// 似然比差距低于 LOW 时使用最长静音时长，高于 HIGH 时使用最短静音时长
+#define ADAPTIVE_EOS_MARGIN_LOW      250
+#define ADAPTIVE_EOS_MARGIN_HIGH     1000
+// 语音帧/噪声帧似然比的平滑系数 1/32
+#define ADAPTIVE_EOS_SMOOTH_SHIFT    5
+
 // 每帧的长度（单位 ms，合法值：10ms/20ms/30ms），建议设置为 10ms
 #define DEFAULT_SPEECH_FRAME_TIME  10
 
+// 能量预门限：噪底按每 10ms 约 0.02dB 缓慢上升，低于噪底时立即跟随
+#define ENERGY_GATE_FLOOR_RISE     1.005f
+// 能量预门限：开始的 100ms 总是运行完整 VAD，以建立噪底
+#define ENERGY_GATE_WARMUP_TIME    100
+// 能量预门限：连续被门限判为静音的帧，每 8 帧仍运行一次完整 VAD，以更新噪声模型
+#define ENERGY_GATE_UPDATE_FRAMES  8
+
+// 批量处理时每次送入 webrtc vad 的实例数
+#define LITEVAD_BATCH_CHUNK        64
+
+// 噪声模型导出格式
+#define NOISE_PROFILE_MAGIC        0x504e564c   // "LVNP"
+#define NOISE_PROFILE_VERSION      1
+
+// 状态快照格式
+#define STATE_MAGIC                0x5453564c   // "LVST"
+#define STATE_VERSION              3
+
+// 语音权重按 10ms 计数，20ms/30ms 帧每帧加减 2/3，保持上述时间语义不变
+#define SPEECH_WEIGHT_FRAME_TIME   10
+
 struct litevad_priv {
     VadInst *vad_inst;
-    int      vad_mode;
+    litevad_config_t config;
     int      rate_idx;
     int      sample_rate;
     int      channel_count;
+    int      frame_time;
     int      active_time;
     int      silence_time;
     int      speech_weight;
     bool     speech_detected;
+    bool     speech_likely;
+    // sample indexes since create/reset, for speech boundary estimation
+    int64_t  processed_samples;
+    int64_t  active_start;      // first sample of current active run
+    int64_t  weight_start;      // first active sample since speech weight was 0
+    int64_t  active_end;        // end of last active frame
+    int64_t  boundary;          // boundary of last speech begin/end
+    // energy pre-gate, disabled if gate_ratio is 0
+    float    gate_ratio;        // frames below noise_floor*gate_ratio are gated
+    float    gate_floor_rise;   // noise floor rise per frame
+    float    noise_floor;       // mean power per sample, < 0 before first frame
+    int      gate_warmup;       // frames left before gating starts
+    int      gated_frames;      // gated frames since webrtc vad last ran
+    int      vad_decision;      // last webrtc vad decision
+    // adaptive eos, smoothed global log likelihood ratio of active and silent
+    // frames of webrtc vad, valid once both were seen
+    int      speech_llr;
+    int      noise_llr;
+    bool     speech_llr_valid;
+    bool     noise_llr_valid;
+    int      eos_silence_time;      // current eos silence time
+    int      eos_silence_weight;    // current eos silence weight
+    // imported noise profile, applied on reset
+    bool     has_noise_profile;
+    WebRtcVadNoiseProfile noise_profile;
+};
+
+struct litevad_noise_profile {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t frame_time;
+    WebRtcVadNoiseProfile model;
+};
+
+// Header of litevad_serialize() state, followed by state_fields of struct
+// litevad_priv packed back to back and the webrtc vad state, in host byte order
+struct litevad_state {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t priv_size;
+    uint32_t vad_size;
+};
+
+#define STATE_FIELD(name) \
+    { offsetof(struct litevad_priv, name), sizeof(((struct litevad_priv *)0)->name) }
+
+// Saved fields of struct litevad_priv, bump STATE_VERSION whenever this list
+// or a field changes
+static const struct {
+    size_t offset;
+    size_t size;
+} state_fields[] = {
+    STATE_FIELD(config),
+    STATE_FIELD(rate_idx),
+    STATE_FIELD(sample_rate),
+    STATE_FIELD(channel_count),
+    STATE_FIELD(frame_time),
+    STATE_FIELD(active_time),
+    STATE_FIELD(silence_time),
+    STATE_FIELD(speech_weight),
+    STATE_FIELD(speech_detected),
+    STATE_FIELD(speech_likely),
+    STATE_FIELD(processed_samples),
+    STATE_FIELD(active_start),
+    STATE_FIELD(weight_start),
+    STATE_FIELD(active_end),
+    STATE_FIELD(boundary),
+    STATE_FIELD(gate_ratio),
+    STATE_FIELD(gate_floor_rise),
+    STATE_FIELD(noise_floor),
+    STATE_FIELD(gate_warmup),
+    STATE_FIELD(gated_frames),
+    STATE_FIELD(vad_decision),
+    STATE_FIELD(speech_llr),
+    STATE_FIELD(noise_llr),
+    STATE_FIELD(speech_llr_valid),
+    STATE_FIELD(noise_llr_valid),
+    STATE_FIELD(eos_silence_time),
+    STATE_FIELD(eos_silence_weight),
+    STATE_FIELD(has_noise_profile),
+    STATE_FIELD(noise_profile),
 };
 
 // valid vad operating mode, A more aggressive (higher mode) VAD is more
@@ -78,6 +197,9 @@ static const int valid_frame_times[] = { 10, 20, 30 };
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 
+_Static_assert(sizeof(struct litevad_noise_profile) == LITEVAD_NOISE_PROFILE_SIZE,
+               "noise profile layout");
+
 static bool valid_vad_mode(int vad_mode)
 {
     for (int i = 0; i < ARRAY_SIZE(valid_vad_modes); i++) {
@@ -87,6 +209,42 @@ static bool valid_vad_mode(int vad_mode)
     return false;
 }
 
+static void litevad_default_config(litevad_config_t *config)
+{
+    config->vad_mode             = DEFAULT_VAD_MODE;
+    config->bos_active_time      = DEFAULT_BOS_ACTIVE_TIME;
+    config->bos_active_weight    = DEFAULT_BOS_ACTIVE_WEIGHT;
+    config->bos_likely_time      = DEFAULT_BOS_LIKELY_TIME;
+    config->eos_silence_time     = DEFAULT_EOS_SILENCE_TIME;
+    config->eos_adaptive         = 0;
+    config->eos_min_silence_time = DEFAULT_EOS_MIN_SILENCE_TIME;
+    config->eos_max_silence_time = DEFAULT_EOS_MAX_SILENCE_TIME;
+}
+
+static bool valid_config(const litevad_config_t *config)
+{
+    if (!valid_vad_mode(config->vad_mode)) {
+        pr_err("Invalid vad mode, valid value: 0/1/2/3");
+        return false;
+    }
+    if (config->bos_active_time <= 0 || config->eos_silence_time <= 0 ||
+        config->bos_likely_time < 0) {
+        pr_err("Invalid bos/eos time, valid value: > 0");
+        return false;
+    }
+    if (config->bos_active_weight < 0 || config->bos_active_weight > 100) {
+        pr_err("Invalid bos weight, valid value: 0~100");
+        return false;
+    }
+    if (config->eos_adaptive &&
+        (config->eos_min_silence_time <= 0 ||
+         config->eos_max_silence_time < config->eos_min_silence_time)) {
+        pr_err("Invalid adaptive eos time, valid value: 0 < min <= max");
+        return false;
+    }
+    return true;
+}
+
 static bool valid_sample_rate(int sample_rate, int *rate_idx)
 {
     for (int i = 0; i < ARRAY_SIZE(valid_sample_rates); i++) {
@@ -98,6 +256,15 @@ static bool valid_sample_rate(int sample_rate, int *rate_idx)
     return false;
 }
 
+static bool valid_frame_time(int frame_time)
+{
+    for (int i = 0; i < ARRAY_SIZE(valid_frame_times); i++) {
+        if (frame_time == valid_frame_times[i])
+            return true;
+    }
+    return false;
+}
+
 static bool valid_frame_size(int rate_idx, int frame_size)
 {
     int samples_per_ms = valid_sample_rates[rate_idx];
@@ -108,13 +275,26 @@ static bool valid_frame_size(int rate_idx, int frame_size)
     return false;
 }
 
-litevad_handle_t litevad_create(int sample_rate, int channel_count, int sample_bits)
+// Speech weight falls from 100 by 1 per silent 10ms, the eos weight follows
+// the eos time so that both end speech after the same silence, e.g. 30 for
+// 700ms. From 1000ms on the weight can't fall that far, -1 leaves the end of
+// speech to the silence time alone.
+static void litevad_update_eos_weight(struct litevad_priv *priv)
 {
-    if (!valid_vad_mode(DEFAULT_VAD_MODE)) {
-        pr_err("Invalid vad mode, valid value: 0/1/2/3");
-        return NULL;
-    }
+    int weight = 100 - priv->eos_silence_time / SPEECH_WEIGHT_FRAME_TIME;
+    priv->eos_silence_weight = weight > 0 ? weight : -1;
+}
+
+// Eos time of the config, the max time until adaptive eos has seen speech
+static void litevad_update_eos_time(struct litevad_priv *priv)
+{
+    priv->eos_silence_time = priv->config.eos_adaptive ?
+                             priv->config.eos_max_silence_time : priv->config.eos_silence_time;
+    litevad_update_eos_weight(priv);
+}
 
+litevad_handle_t litevad_create(int sample_rate, int channel_count, int sample_bits, int frame_time)
+{
     int rate_idx = 0;
     if (!valid_sample_rate(sample_rate, &rate_idx)) {
         pr_err("Invalid sampling frequency, valid value: 8000/16000/32000/48000");
@@ -132,6 +312,13 @@ litevad_handle_t litevad_create(int sample_rate, int channel_count, int sample_b
         return NULL;
     }
 
+    if (frame_time <= 0)
+        frame_time = DEFAULT_SPEECH_FRAME_TIME;
+    if (!valid_frame_time(frame_time)) {
+        pr_err("Invalid frame time, valid value: 10/20/30");
+        return NULL;
+    }
+
     int ret = 0;
     struct litevad_priv *priv =
             (struct litevad_priv *)calloc(1, sizeof(struct litevad_priv));
@@ -150,16 +337,20 @@ litevad_handle_t litevad_create(int sample_rate, int channel_count, int sample_b
         goto bail;
     }
 
-    ret = WebRtcVad_set_mode(priv->vad_inst, DEFAULT_VAD_MODE);
+    litevad_default_config(&priv->config);
+    ret = WebRtcVad_set_mode(priv->vad_inst, priv->config.vad_mode);
     if (ret != 0) {
         pr_err("Failed to set vad mode");
         goto bail;
     }
 
-    priv->vad_mode         = DEFAULT_VAD_MODE;
     priv->rate_idx         = rate_idx;
     priv->sample_rate      = sample_rate;
     priv->channel_count    = channel_count;
+    priv->frame_time       = frame_time;
+    priv->noise_floor      = -1.0f;
+    priv->gate_warmup      = ENERGY_GATE_WARMUP_TIME / frame_time;
+    litevad_update_eos_time(priv);
     return (litevad_handle_t)priv;
 
 bail:
@@ -169,28 +360,99 @@ bail:
     return NULL;
 }
 
-static int litevad_process_frame(litevad_handle_t handle, const short *frame_buff, int frame_size)
+// Energy pre-gate, returns true if the frame can be taken as silence without
+// running webrtc vad. Not applied while webrtc vad is in its hangover, and the
+// model is still updated every ENERGY_GATE_UPDATE_FRAMES gated frames.
+static bool litevad_gate_frame(struct litevad_priv *priv, const short *frame_buff, int frame_size)
 {
-    struct litevad_priv *priv = (struct litevad_priv *)handle;
-    if (!valid_frame_size(priv->rate_idx, frame_size)) {
-        pr_err("Invalid frame size, valid frame time: 10ms/20ms/30ms");
-        return LITEVAD_RESULT_ERROR;
+    if (priv->gate_ratio <= 0)
+        return false;
+
+    int scale = 0;
+    int32_t energy = WebRtcSpl_Energy((int16_t *)frame_buff, frame_size, &scale);
+    float power = (float)energy * (float)(1 << scale) / frame_size;
+    bool gated = priv->gate_warmup == 0 && priv->vad_decision == 0 &&
+                 power <= priv->noise_floor * priv->gate_ratio;
+
+    // Noise floor follows drops at once and rises slowly, so that it stays
+    // close to the quietest recent frames, speech included
+    if (priv->noise_floor < 0 || power < priv->noise_floor)
+        priv->noise_floor = power;
+    else
+        priv->noise_floor *= priv->gate_floor_rise;
+    if (priv->noise_floor < 1.0f)
+        priv->noise_floor = 1.0f;
+    if (priv->gate_warmup > 0)
+        priv->gate_warmup--;
+
+    if (gated && ++priv->gated_frames >= ENERGY_GATE_UPDATE_FRAMES)
+        gated = false;
+    if (!gated)
+        priv->gated_frames = 0;
+    return gated;
+}
+
+// Adaptive eos: the margin between smoothed likelihood ratios of speech and
+// noise frames, which grows with snr, maps linearly to the eos silence time,
+// large margin to the min time, small margin to the max time
+static void litevad_update_likelihood(struct litevad_priv *priv, int vad_decision)
+{
+    int llr = 0, threshold = 0;
+    WebRtcVad_GetLikelihood(priv->vad_inst, &llr, &threshold);
+    if (vad_decision == 1) {
+        if (!priv->speech_llr_valid)
+            priv->speech_llr = llr;
+        priv->speech_llr += (llr - priv->speech_llr) / (1 << ADAPTIVE_EOS_SMOOTH_SHIFT);
+        priv->speech_llr_valid = true;
+    } else {
+        if (!priv->noise_llr_valid)
+            priv->noise_llr = llr;
+        priv->noise_llr += (llr - priv->noise_llr) / (1 << ADAPTIVE_EOS_SMOOTH_SHIFT);
+        priv->noise_llr_valid = true;
     }
 
+    // Speech all along, as in loud noise, is no ground for ending early
+    int margin = 0;
+    if (priv->speech_llr_valid && priv->noise_llr_valid)
+        margin = priv->speech_llr - priv->noise_llr;
+    int min_time = priv->config.eos_min_silence_time;
+    int max_time = priv->config.eos_max_silence_time;
+    if (margin <= ADAPTIVE_EOS_MARGIN_LOW)
+        priv->eos_silence_time = max_time;
+    else if (margin >= ADAPTIVE_EOS_MARGIN_HIGH)
+        priv->eos_silence_time = min_time;
+    else
+        priv->eos_silence_time = max_time - (max_time - min_time) *
+            (margin - ADAPTIVE_EOS_MARGIN_LOW) / (ADAPTIVE_EOS_MARGIN_HIGH - ADAPTIVE_EOS_MARGIN_LOW);
+    litevad_update_eos_weight(priv);
+}
+
+// Account the webrtc vad decision of a frame, or 0 if it was gated
+static int litevad_apply_decision(struct litevad_priv *priv, int ret, int frame_size)
+{
     int frame_time = frame_size / valid_sample_rates[priv->rate_idx];
-    int ret = WebRtcVad_Process(priv->vad_inst, priv->sample_rate, frame_buff, frame_size);
+    int weight_step = frame_time / SPEECH_WEIGHT_FRAME_TIME;
+    int64_t frame_start = priv->processed_samples;
+    priv->processed_samples += frame_size;
     if (ret == 1) {
+        if (priv->active_time == 0)
+            priv->active_start = frame_start;
+        if (priv->speech_weight == 0)
+            priv->weight_start = frame_start;
+        priv->active_end = frame_start + frame_size;
         priv->silence_time = 0;
         priv->active_time += frame_time;
-        if (priv->speech_weight < 100)
-            priv->speech_weight++;
+        priv->speech_weight += weight_step;
+        if (priv->speech_weight > 100)
+            priv->speech_weight = 100;
         ret = LITEVAD_RESULT_FRAME_ACTIVE;
     }
     else if (ret == 0) {
         priv->silence_time += frame_time;
         priv->active_time = 0;
-        if (priv->speech_weight > 0)
-           priv->speech_weight--;
+        priv->speech_weight -= weight_step;
+        if (priv->speech_weight < 0)
+            priv->speech_weight = 0;
         ret = LITEVAD_RESULT_FRAME_SILENCE;
     }
     else {
@@ -198,8 +460,81 @@ static int litevad_process_frame(litevad_handle_t handle, const short *frame_buf
         ret = LITEVAD_RESULT_ERROR;
     }
 
-    //pr_dbg("Process: ret=%d, active_time=%d(ms), silence_time=%d(ms), speech_weight=%d",
-    //                    ret, priv->active_time, priv->silence_time, priv->speech_weight);
+    vadtrace_frame(VADTRACE_LITEVAD_FRAME, ret, priv->speech_weight);
+    return ret;
+}
+
+// Keep the decision of webrtc vad for gate and adaptive eos
+static void litevad_vad_done(struct litevad_priv *priv, int ret)
+{
+    priv->vad_decision = ret;
+    if (ret >= 0 && priv->config.eos_adaptive)
+        litevad_update_likelihood(priv, ret);
+}
+
+static int litevad_process_frame(litevad_handle_t handle, const short *frame_buff, int frame_size)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    if (!valid_frame_size(priv->rate_idx, frame_size)) {
+        pr_err("Invalid frame size, valid frame time: 10ms/20ms/30ms");
+        return LITEVAD_RESULT_ERROR;
+    }
+
+    int ret = 0;
+    if (!litevad_gate_frame(priv, frame_buff, frame_size)) {
+        ret = WebRtcVad_Process(priv->vad_inst, priv->sample_rate, frame_buff, frame_size);
+        litevad_vad_done(priv, ret);
+    }
+    return litevad_apply_decision(priv, ret, frame_size);
+}
+
+// Speech begin/end state machine, takes the decision of a frame
+static litevad_result_t litevad_update_state(struct litevad_priv *priv, litevad_result_t ret)
+{
+    if (!priv->speech_detected &&
+        priv->active_time < priv->config.bos_active_time &&
+        priv->speech_weight < priv->config.bos_active_weight) {
+        if (!priv->speech_likely && priv->config.bos_likely_time > 0 &&
+            priv->active_time >= priv->config.bos_likely_time) {
+            vadtrace_segment(VADTRACE_SPEECH_LIKELY, priv->active_time, priv->speech_weight);
+            priv->speech_likely = true;
+            return LITEVAD_RESULT_SPEECH_LIKELY;
+        }
+        if (priv->speech_likely && priv->speech_weight == 0) {
+            vadtrace_segment(VADTRACE_SPEECH_CANCELLED, priv->silence_time, 0);
+            priv->speech_likely = false;
+            return LITEVAD_RESULT_SPEECH_CANCELLED;
+        }
+        return LITEVAD_RESULT_FRAME_SILENCE;
+    }
+
+    if (!priv->speech_detected) {
+        pr_dbg("speech begin");
+        vadtrace_segment(VADTRACE_SPEECH_BEGIN, priv->active_time, priv->speech_weight);
+        // Speech began with the active run, or with the pauses counted by weight
+        priv->boundary = priv->active_time >= priv->config.bos_active_time ?
+                         priv->active_start : priv->weight_start;
+        priv->speech_detected = true;
+        priv->speech_likely = false;
+        priv->speech_weight = 100;
+        priv->silence_time = 0;
+        return LITEVAD_RESULT_SPEECH_BEGIN;
+    }
+
+    if (priv->silence_time < priv->eos_silence_time &&
+        priv->speech_weight > priv->eos_silence_weight) {
+        return LITEVAD_RESULT_FRAME_ACTIVE;
+    }
+    else if (ret == LITEVAD_RESULT_FRAME_SILENCE) {
+        pr_dbg("speech end");
+        vadtrace_segment(VADTRACE_SPEECH_END, priv->silence_time, priv->speech_weight);
+        priv->boundary = priv->active_end;
+        priv->active_time = 0;
+        priv->silence_time = 0;
+        priv->speech_weight = 0;
+        priv->speech_detected = false;
+        return LITEVAD_RESULT_SPEECH_END;
+    }
     return ret;
 }
 
@@ -208,7 +543,7 @@ litevad_result_t litevad_process(litevad_handle_t handle, const void *buff, int
     struct litevad_priv *priv = (struct litevad_priv *)handle;
     short *frame_buff = (short *)buff;
     int nsamples = size / sizeof(short);
-    int frame_size = DEFAULT_SPEECH_FRAME_TIME * valid_sample_rates[priv->rate_idx];
+    int frame_size = priv->frame_time * valid_sample_rates[priv->rate_idx];
     int i = 0, ret = 0;
 
     if ((nsamples % frame_size) != 0) {
@@ -220,42 +555,285 @@ litevad_result_t litevad_process(litevad_handle_t handle, const void *buff, int
         ret = litevad_process_frame(priv, &frame_buff[i], frame_size);
         if (ret == LITEVAD_RESULT_ERROR)
             break;
+        ret = litevad_update_state(priv, (litevad_result_t)ret);
+        // FIXME: ignore left data if speech-begin/end detected, use
+        // litevad_process_frames() to get the result of every frame
+        if (ret == LITEVAD_RESULT_SPEECH_BEGIN || ret == LITEVAD_RESULT_SPEECH_END)
+            break;
+        i += frame_size;
+    }
 
-        if (!priv->speech_detected &&
-            priv->active_time < DEFAULT_BOS_ACTIVE_TIME &&
-            priv->speech_weight < DEFAULT_BOS_ACTIVE_WEIGHT) {
-            ret = LITEVAD_RESULT_FRAME_SILENCE;
+    return (litevad_result_t)ret;
+}
+
+int litevad_process_frames(litevad_handle_t handle, const void *buff, int size,
+                           unsigned char *results, int64_t *boundaries)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    short *frame_buff = (short *)buff;
+    int nsamples = size / sizeof(short);
+    int frame_size = priv->frame_time * valid_sample_rates[priv->rate_idx];
+    int nframes = nsamples / frame_size;
+
+    if ((nsamples % frame_size) != 0) {
+        pr_err("Invalid frame length");
+        return -1;
+    }
+
+    for (int i = 0; i < nframes; i++) {
+        int ret = litevad_process_frame(priv, &frame_buff[i*frame_size], frame_size);
+        if (ret == LITEVAD_RESULT_ERROR)
+            return -1;
+        results[i] = (unsigned char)litevad_update_state(priv, (litevad_result_t)ret);
+        if (boundaries != NULL &&
+            (results[i] == LITEVAD_RESULT_SPEECH_BEGIN || results[i] == LITEVAD_RESULT_SPEECH_END))
+            boundaries[i] = priv->boundary;
+    }
+
+    return nframes;
+}
+
+void litevad_get_config(litevad_handle_t handle, litevad_config_t *config)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    if (priv == NULL)
+        litevad_default_config(config);
+    else
+        *config = priv->config;
+}
+
+int litevad_set_config(litevad_handle_t handle, const litevad_config_t *config)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    if (!valid_config(config))
+        return -1;
+    if (WebRtcVad_set_mode(priv->vad_inst, config->vad_mode) != 0) {
+        pr_err("Failed to set vad mode");
+        return -1;
+    }
+    priv->config = *config;
+    litevad_update_eos_time(priv);
+    return 0;
+}
+
+int litevad_get_noise_profile(litevad_handle_t handle, void *profile, int size)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    struct litevad_noise_profile blob;
+    if (profile == NULL || size < (int)sizeof(blob)) {
+        pr_err("Invalid noise profile buffer, size: %d", LITEVAD_NOISE_PROFILE_SIZE);
+        return -1;
+    }
+
+    memset(&blob, 0, sizeof(blob));
+    blob.magic = NOISE_PROFILE_MAGIC;
+    blob.version = NOISE_PROFILE_VERSION;
+    blob.frame_time = (uint16_t)priv->frame_time;
+    if (WebRtcVad_GetNoiseProfile(priv->vad_inst, &blob.model) != 0) {
+        pr_err("Failed to get noise profile");
+        return -1;
+    }
+    memcpy(profile, &blob, sizeof(blob));
+    return sizeof(blob);
+}
+
+int litevad_set_noise_profile(litevad_handle_t handle, const void *profile, int size)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    struct litevad_noise_profile blob;
+    if (profile == NULL) {
+        priv->has_noise_profile = false;
+        return 0;
+    }
+    if (size != (int)sizeof(blob)) {
+        pr_err("Invalid noise profile size: %d", size);
+        return -1;
+    }
+
+    memcpy(&blob, profile, sizeof(blob));
+    if (blob.magic != NOISE_PROFILE_MAGIC || blob.version != NOISE_PROFILE_VERSION) {
+        pr_err("Invalid noise profile");
+        return -1;
+    }
+    if (blob.frame_time != priv->frame_time) {
+        // Band energies, hence the model, depend on frame length
+        pr_err("Noise profile of %dms frames, expected %dms", blob.frame_time, priv->frame_time);
+        return -1;
+    }
+    if (WebRtcVad_SetNoiseProfile(priv->vad_inst, &blob.model) != 0) {
+        pr_err("Failed to set noise profile");
+        return -1;
+    }
+    priv->noise_profile = blob.model;
+    priv->has_noise_profile = true;
+    return 0;
+}
+
+int litevad_set_energy_gate(litevad_handle_t handle, int margin_db)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    if (margin_db < 0 || margin_db > 40) {
+        pr_err("Invalid energy gate margin, valid value: 0~40dB");
+        return -1;
+    }
+
+    // 10^(margin_db/10) and 10ms rise to frame rise, without libm
+    float ratio = 0.0f;
+    if (margin_db > 0) {
+        ratio = 1.0f;
+        for (int i = 0; i < margin_db; i++)
+            ratio *= 1.2589254f;
+    }
+    float rise = 1.0f;
+    for (int i = 0; i < priv->frame_time / SPEECH_WEIGHT_FRAME_TIME; i++)
+        rise *= ENERGY_GATE_FLOOR_RISE;
+    priv->gate_ratio = ratio;
+    priv->gate_floor_rise = rise;
+    return 0;
+}
+
+int litevad_process_batch(litevad_handle_t *handles, const void **buffs, int count,
+                          unsigned char *results, int64_t *boundaries)
+{
+    VadInst *insts[LITEVAD_BATCH_CHUNK];
+    const int16_t *frames[LITEVAD_BATCH_CHUNK];
+    int decisions[LITEVAD_BATCH_CHUNK];
+    int vads[LITEVAD_BATCH_CHUNK];
+    int indexes[LITEVAD_BATCH_CHUNK];
+    if (count <= 0)
+        return 0;
+
+    struct litevad_priv *first = (struct litevad_priv *)handles[0];
+    int frame_size = first->frame_time * valid_sample_rates[first->rate_idx];
+    for (int i = 1; i < count; i++) {
+        struct litevad_priv *priv = (struct litevad_priv *)handles[i];
+        if (priv->sample_rate != first->sample_rate || priv->frame_time != first->frame_time) {
+            pr_err("Invalid batch, sample rate and frame time differ");
+            return -1;
         }
-        else {
-            if (!priv->speech_detected) {
-                pr_dbg("speech begin");
-                priv->speech_detected = true;
-                priv->speech_weight = 100;
-                priv->silence_time = 0;
-                ret = LITEVAD_RESULT_SPEECH_BEGIN;
-                // FIXME: ignore left data if speech-begin detected, you should comment
-                // following line if you don't care about speech-begin event
-                break;
-            }
+    }
 
-            if (priv->silence_time < DEFAULT_EOS_SILENCE_TIME &&
-                priv->speech_weight > DEFAULT_EOS_SILENCE_WEIGHT) {
-                ret = LITEVAD_RESULT_FRAME_ACTIVE;
-            }
-            else if (ret == LITEVAD_RESULT_FRAME_SILENCE) {
-                pr_dbg("speech end");
-                priv->active_time = 0;
-                priv->silence_time = 0;
-                priv->speech_weight = 0;
-                priv->speech_detected = false;
-                ret = LITEVAD_RESULT_SPEECH_END;
-                break;
+    for (int base = 0; base < count; base += LITEVAD_BATCH_CHUNK) {
+        int n = count - base < LITEVAD_BATCH_CHUNK ? count - base : LITEVAD_BATCH_CHUNK;
+        int vad_count = 0;
+        for (int i = 0; i < n; i++) {
+            struct litevad_priv *priv = (struct litevad_priv *)handles[base + i];
+            const short *frame_buff = (const short *)buffs[base + i];
+            vads[i] = 0;
+            if (!litevad_gate_frame(priv, frame_buff, frame_size)) {
+                insts[vad_count] = priv->vad_inst;
+                frames[vad_count] = frame_buff;
+                indexes[vad_count] = i;
+                vad_count++;
             }
         }
-        i += frame_size;
+
+        if (WebRtcVad_ProcessBatch(insts, first->sample_rate, frames, frame_size,
+                                   vad_count, decisions) != 0) {
+            pr_err("Failed to process vad instances");
+            return -1;
+        }
+        for (int i = 0; i < vad_count; i++) {
+            vads[indexes[i]] = decisions[i];
+            litevad_vad_done((struct litevad_priv *)handles[base + indexes[i]], decisions[i]);
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct litevad_priv *priv = (struct litevad_priv *)handles[base + i];
+            int ret = litevad_apply_decision(priv, vads[i], frame_size);
+            results[base + i] = (unsigned char)litevad_update_state(priv, (litevad_result_t)ret);
+            if (boundaries != NULL &&
+                (results[base + i] == LITEVAD_RESULT_SPEECH_BEGIN ||
+                 results[base + i] == LITEVAD_RESULT_SPEECH_END))
+                boundaries[base + i] = priv->boundary;
+        }
     }
+    return 0;
+}
 
-    return (litevad_result_t)ret;
+static int litevad_state_fields_size(void)
+{
+    int size = 0;
+    for (int i = 0; i < ARRAY_SIZE(state_fields); i++)
+        size += (int)state_fields[i].size;
+    return size;
+}
+
+int litevad_serialize(litevad_handle_t handle, void *state, int size)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    struct litevad_state header;
+    int priv_size = litevad_state_fields_size();
+    int state_size = sizeof(header) + priv_size + (int)WebRtcVad_StateSize();
+    if (state == NULL)
+        return state_size;
+    if (size < state_size) {
+        pr_err("State buffer too small: %d, expected %d", size, state_size);
+        return -1;
+    }
+
+    char *dst = (char *)state;
+    header.magic = STATE_MAGIC;
+    header.version = STATE_VERSION;
+    header.priv_size = (uint16_t)priv_size;
+    header.vad_size = (uint32_t)WebRtcVad_StateSize();
+    if (WebRtcVad_SaveState(priv->vad_inst, dst + sizeof(header) + priv_size,
+                            header.vad_size) != 0) {
+        pr_err("Failed to save vad state");
+        return -1;
+    }
+    memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+    for (int i = 0; i < ARRAY_SIZE(state_fields); i++) {
+        memcpy(dst, (const char *)priv + state_fields[i].offset, state_fields[i].size);
+        dst += state_fields[i].size;
+    }
+    return state_size;
+}
+
+int litevad_deserialize(litevad_handle_t handle, const void *state, int size)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    struct litevad_state header;
+    struct litevad_priv saved = *priv;
+    int priv_size = litevad_state_fields_size();
+    const char *src = (const char *)state;
+    if (state == NULL || size < (int)sizeof(header)) {
+        pr_err("Invalid state size: %d", size);
+        return -1;
+    }
+
+    memcpy(&header, src, sizeof(header));
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION ||
+        header.priv_size != priv_size || header.vad_size != WebRtcVad_StateSize() ||
+        size != (int)(sizeof(header) + priv_size + header.vad_size)) {
+        pr_err("Invalid state, saved by another version?");
+        return -1;
+    }
+    src += sizeof(header);
+    for (int i = 0; i < ARRAY_SIZE(state_fields); i++) {
+        memcpy((char *)&saved + state_fields[i].offset, src, state_fields[i].size);
+        src += state_fields[i].size;
+    }
+    if (saved.sample_rate != priv->sample_rate || saved.channel_count != priv->channel_count ||
+        saved.frame_time != priv->frame_time) {
+        pr_err("State of %dHz/%dch/%dms, expected %dHz/%dch/%dms",
+               saved.sample_rate, saved.channel_count, saved.frame_time,
+               priv->sample_rate, priv->channel_count, priv->frame_time);
+        return -1;
+    }
+    if (WebRtcVad_RestoreState(priv->vad_inst, src, header.vad_size) != 0) {
+        pr_err("Failed to restore vad state");
+        return -1;
+    }
+    *priv = saved;
+    return 0;
+}
+
+int64_t litevad_get_boundary(litevad_handle_t handle)
+{
+    struct litevad_priv *priv = (struct litevad_priv *)handle;
+    return priv->boundary;
 }
 
 void litevad_reset(litevad_handle_t handle)
@@ -265,8 +843,25 @@ void litevad_reset(litevad_handle_t handle)
     priv->silence_time = 0;
     priv->speech_weight = 0;
     priv->speech_detected = false;
+    priv->speech_likely = false;
+    priv->processed_samples = 0;
+    priv->active_start = 0;
+    priv->weight_start = 0;
+    priv->active_end = 0;
+    priv->boundary = 0;
+    priv->noise_floor = -1.0f;
+    priv->gate_warmup = ENERGY_GATE_WARMUP_TIME / priv->frame_time;
+    priv->gated_frames = 0;
+    priv->vad_decision = 0;
+    priv->speech_llr = 0;
+    priv->noise_llr = 0;
+    priv->speech_llr_valid = false;
+    priv->noise_llr_valid = false;
+    litevad_update_eos_time(priv);
     WebRtcVad_Init(priv->vad_inst);
-    WebRtcVad_set_mode(priv->vad_inst, priv->vad_mode);
+    WebRtcVad_set_mode(priv->vad_inst, priv->config.vad_mode);
+    if (priv->has_noise_profile)
+        WebRtcVad_SetNoiseProfile(priv->vad_inst, &priv->noise_profile);
 }
 
 void litevad_destroy(litevad_handle_t handle)
@@ -17,6 +17,8 @@
 #ifndef __LITEVAD_H
 #define __LITEVAD_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -27,14 +29,108 @@ typedef enum {
     LITEVAD_RESULT_FRAME_ACTIVE = 1,
     LITEVAD_RESULT_SPEECH_BEGIN = 2,
     LITEVAD_RESULT_SPEECH_END = 3,
+    LITEVAD_RESULT_SPEECH_LIKELY = 4,       // first active frames, speech may begin
+    LITEVAD_RESULT_SPEECH_CANCELLED = 5,    // activity since likely faded out
 } litevad_result_t;
 
 typedef void *litevad_handle_t;
 
-litevad_handle_t litevad_create(int sample_rate, int channel_count, int sample_bits);
+// Runtime config, times in ms, weights in 0~100. Speech begins after
+// bos_active_time of continuous activity or once the speech weight (+1 per
+// active 10ms, -1 per silent 10ms) reaches bos_active_weight, and ends after
+// eos silence time of continuous silence or once the weight falls by as much
+// as the eos silence time allows, whichever comes first.
+typedef struct {
+    int vad_mode;               // 0~3, higher is more restrictive in reporting speech
+    int bos_active_time;
+    int bos_active_weight;
+    int bos_likely_time;        // speech likely after this much continuous activity,
+                                // then confirmed by speech begin or cancelled once
+                                // the speech weight is back to 0, 0 disables it
+    int eos_silence_time;       // eos silence time if not adaptive
+    int eos_adaptive;           // non-zero: eos silence time follows the likelihood
+                                // margin between speech and noise, short for clear
+                                // speech, long in noisy conditions
+    int eos_min_silence_time;   // adaptive eos silence time range
+    int eos_max_silence_time;
+} litevad_config_t;
+
+// frame_time: analysis frame length in ms, 10/20/30, 0 for default (10ms),
+// litevad_process() only accepts buffers of a multiple of it
+litevad_handle_t litevad_create(int sample_rate, int channel_count, int sample_bits, int frame_time);
+
+// Analyze one frame for each of count handles, which must share sample rate
+// and frame time, buffs[i] holds the frame of handles[i]. The result and, if
+// boundaries is not NULL, the boundary of each handle are written at its
+// index as litevad_process_frames() does. Each vad stage runs over all
+// handles before the next one, with the filterbank in SIMD lanes where the
+// cpu has them; vad_bench compares its throughput with a call per handle.
+// Returns 0, or -1 on error.
+int litevad_process_batch(litevad_handle_t *handles, const void **buffs, int count,
+                          unsigned char *results, int64_t *boundaries);
+
+// Size of noise profile blob: "LVNP", version and frame time, then the noise
+// model of webrtc vad, in host byte order
+#define LITEVAD_NOISE_PROFILE_SIZE 260
+
+// Export the noise model of a running handle to profile, which holds
+// LITEVAD_NOISE_PROFILE_SIZE bytes. Returns the size written, or -1 on error.
+int litevad_get_noise_profile(litevad_handle_t handle, void *profile, int size);
+
+// Import a noise profile exported from a handle of the same frame time, so
+// that the handle starts with the noise model of the device instead of
+// adapting to it for the first second or so, which avoids false speech begins
+// in noisy rooms. Applied at once and again on each litevad_reset(), NULL
+// profile drops it. Returns 0 on success, -1 on error.
+int litevad_set_noise_profile(litevad_handle_t handle, const void *profile, int size);
+
+// Save the whole state of handle: config, speech state, energy gate, noise
+// profile and the webrtc vad models, so that a stream can move to another
+// handle, e.g. on another thread or process, and go on as if never moved.
+// The state is a versioned blob of the needed fields only, in host byte order,
+// so it does not move between hosts of another byte order. Returns the size
+// written, the size needed if state is NULL, or -1 on error.
+int litevad_serialize(litevad_handle_t handle, void *state, int size);
 
+// Restore a state saved by litevad_serialize() into a handle created with the
+// same sample rate, channel count and frame time. Returns 0 on success, -1 on
+// error, in which case the handle is left as it was.
+int litevad_deserialize(litevad_handle_t handle, const void *state, int size);
+
+// Get config of handle, or the default config if handle is NULL
+void litevad_get_config(litevad_handle_t handle, litevad_config_t *config);
+
+// Takes effect from next frame, returns 0 on success, -1 on invalid config
+int litevad_set_config(litevad_handle_t handle, const litevad_config_t *config);
+
+// Stops at the first speech begin/end, the rest of buff is not analyzed. Speech
+// likely/cancelled only show if on the last frame, use litevad_process_frames()
+// for them
 litevad_result_t litevad_process(litevad_handle_t handle, const void *buff, int size);
 
+// Analyze every frame of buff, size is a multiple of frame size. The result of
+// each frame is written to results as litevad_result_t, one byte per frame, so
+// results must hold size/frame_size bytes. If boundaries is not NULL, the
+// estimated boundary of each speech begin/end is written at the index of its
+// frame, see litevad_get_boundary(). Returns the number of frames, or -1 on
+// error.
+int litevad_process_frames(litevad_handle_t handle, const void *buff, int size,
+                           unsigned char *results, int64_t *boundaries);
+
+// Energy pre-gate: frames whose power is within margin_db above an adaptive
+// noise floor are taken as silence without running the full vad, whose noise
+// model is still updated every few gated frames. Saves most of the cpu on idle
+// streams, at the cost of missing speech that starts very softly. 0 disables
+// the gate (default), valid value: 0~40, 6~10dB recommended. Returns 0 on
+// success, -1 on error.
+int litevad_set_energy_gate(litevad_handle_t handle, int margin_db);
+
+// Estimated boundary of the last speech begin/end, as index of the first
+// sample of speech, or of the sample after its last active frame, counted
+// from create/reset. Speech begin is reported hundreds of ms after speech
+// started, the boundary tells how much audio before it belongs to speech.
+int64_t litevad_get_boundary(litevad_handle_t handle);
+
 void litevad_reset(litevad_handle_t handle);
 
 void litevad_destroy(litevad_handle_t handle);
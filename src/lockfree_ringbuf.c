@@ -114,22 +114,7 @@ void lockfree_ringbuf_unsafe_reset(void *handle)
 
 int lockfree_ringbuf_unsafe_discard(void *handle, int len)
 {
-    struct lockfree_ringbuf *rb = (struct lockfree_ringbuf *)handle;
-    if (rb == NULL || len <= 0)
-        return LOCKFREE_RINGBUF_ERROR_INVALID_PARAMETER;
-    int filled = ATOMIC_LOAD(rb->filled_size);
-    len = (len > filled) ? filled : len;
-    if (len > 0) {
-        if ((rb->p_r + len) > (rb->p_o + rb->buffer_size)) {
-            int rlen1 = rb->p_o + rb->buffer_size - rb->p_r;
-            int rlen2 = len - rlen1;
-            rb->p_r = rb->p_o + rlen2;
-        } else {
-            rb->p_r = rb->p_r + len;
-        }
-        ATOMIC_FETCH_SUB(rb->filled_size, len);
-    }
-    return len;
+    return lockfree_ringbuf_consume(handle, len);
 }
 
 int lockfree_ringbuf_unsafe_overwrite(void *handle, char *buf, int len)
@@ -205,3 +190,50 @@ int lockfree_ringbuf_read(void *handle, char *buf, int len)
     }
     return len;
 }
+
+int lockfree_ringbuf_peek(void *handle, char **buf1, int *len1, char **buf2, int *len2)
+{
+    struct lockfree_ringbuf *rb = (struct lockfree_ringbuf *)handle;
+    if (rb == NULL || buf1 == NULL || len1 == NULL || buf2 == NULL || len2 == NULL)
+        return LOCKFREE_RINGBUF_ERROR_INVALID_PARAMETER;
+    int filled = ATOMIC_LOAD(rb->filled_size);
+    int rlen1 = rb->p_o + rb->buffer_size - rb->p_r;
+    if (rlen1 == 0) {
+        // read pointer reached the end, data starts from the beginning
+        *buf1 = rb->p_o;
+        *len1 = filled;
+        *buf2 = NULL;
+        *len2 = 0;
+    } else if (filled > rlen1) {
+        *buf1 = rb->p_r;
+        *len1 = rlen1;
+        *buf2 = rb->p_o;
+        *len2 = filled - rlen1;
+    } else {
+        *buf1 = rb->p_r;
+        *len1 = filled;
+        *buf2 = NULL;
+        *len2 = 0;
+    }
+    return filled;
+}
+
+int lockfree_ringbuf_consume(void *handle, int len)
+{
+    struct lockfree_ringbuf *rb = (struct lockfree_ringbuf *)handle;
+    if (rb == NULL || len <= 0)
+        return LOCKFREE_RINGBUF_ERROR_INVALID_PARAMETER;
+    int filled = ATOMIC_LOAD(rb->filled_size);
+    len = (len > filled) ? filled : len;
+    if (len > 0) {
+        if ((rb->p_r + len) > (rb->p_o + rb->buffer_size)) {
+            int rlen1 = rb->p_o + rb->buffer_size - rb->p_r;
+            int rlen2 = len - rlen1;
+            rb->p_r = rb->p_o + rlen2;
+        } else {
+            rb->p_r = rb->p_r + len;
+        }
+        ATOMIC_FETCH_SUB(rb->filled_size, len);
+    }
+    return len;
+}
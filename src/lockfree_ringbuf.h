@@ -47,6 +47,14 @@ int lockfree_ringbuf_write(void *handle, char *buf, int len);
 
 int lockfree_ringbuf_read(void *handle, char *buf, int len);
 
+// Zero-copy read: get the filled data as up to two contiguous regions (the
+// second one is set if data wraps around), returns total bytes of regions.
+// Data stays in ringbuf until lockfree_ringbuf_consume() is called.
+int lockfree_ringbuf_peek(void *handle, char **buf1, int *len1, char **buf2, int *len2);
+
+// Release len bytes from read side, usually after lockfree_ringbuf_peek().
+int lockfree_ringbuf_consume(void *handle, int len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pcm_convert.h"
+
+// Kernels are selected at compile time, all of them give the same result as
+// the scalar code below. PCM_DISABLE_SIMD keeps the scalar code, as a
+// reference for tests.
+#if defined(PCM_DISABLE_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define CONVERT_SIMD 1
+#define VEC_SAMPLES 16
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CONVERT_SIMD 1
+#define VEC_SAMPLES 8
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_SIMD 1
+#define VEC_SAMPLES 8
+#endif
+
+// Adding then subtracting 1.5*2^23 rounds a float of magnitude below 2^22 to
+// the nearest integer, ties to even, as cvtps does in the default mode
+#define ROUND_MAGIC 12582912.0f
+
+#if defined(CONVERT_SIMD) && defined(__AVX2__)
+
+static inline void vec_s32_to_s16(const int32_t *in, short *out)
+{
+    __m256i a = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)in), 16);
+    __m256i b = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)(in + 8)), 16);
+    // packs works per 128-bit lane, put the quadwords back in order
+    _mm256_storeu_si256((__m256i *)out, _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+}
+
+static inline __m256i vec_f32_to_s32(const float *in)
+{
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(in), _mm256_set1_ps(32768.0f));
+    // max first, so that NaN becomes -32768 as in the scalar code
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-32768.0f)), _mm256_set1_ps(32767.0f));
+    return _mm256_cvtps_epi32(v);
+}
+
+static inline void vec_f32_to_s16(const float *in, short *out)
+{
+    __m256i a = vec_f32_to_s32(in);
+    __m256i b = vec_f32_to_s32(in + 8);
+    _mm256_storeu_si256((__m256i *)out, _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8));
+}
+
+#elif defined(CONVERT_SIMD) && defined(__SSE2__)
+
+static inline void vec_s32_to_s16(const int32_t *in, short *out)
+{
+    __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)in), 16);
+    __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(in + 4)), 16);
+    _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(a, b));
+}
+
+static inline __m128i vec_f32_to_s32(const float *in)
+{
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(in), _mm_set1_ps(32768.0f));
+    // max first, so that NaN becomes -32768 as in the scalar code
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f));
+    return _mm_cvtps_epi32(v);
+}
+
+static inline void vec_f32_to_s16(const float *in, short *out)
+{
+    _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(vec_f32_to_s32(in), vec_f32_to_s32(in + 4)));
+}
+
+#elif defined(CONVERT_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+
+static inline void vec_s32_to_s16(const int32_t *in, short *out)
+{
+    vst1q_s16(out, vcombine_s16(vshrn_n_s32(vld1q_s32(in), 16), vshrn_n_s32(vld1q_s32(in + 4), 16)));
+}
+
+static inline int16x4_t vec_f32_to_s16_half(const float *in)
+{
+    float32x4_t v = vmulq_n_f32(vld1q_f32(in), 32768.0f);
+    // vmaxq/vminq return NaN for NaN, compare explicitly like the scalar code
+    v = vbslq_f32(vcgtq_f32(v, vdupq_n_f32(-32768.0f)), v, vdupq_n_f32(-32768.0f));
+    v = vminq_f32(v, vdupq_n_f32(32767.0f));
+    // armv7 has no round to nearest conversion, round first then truncate
+    v = vsubq_f32(vaddq_f32(v, vdupq_n_f32(ROUND_MAGIC)), vdupq_n_f32(ROUND_MAGIC));
+    return vmovn_s32(vcvtq_s32_f32(v));
+}
+
+static inline void vec_f32_to_s16(const float *in, short *out)
+{
+    vst1q_s16(out, vcombine_s16(vec_f32_to_s16_half(in), vec_f32_to_s16_half(in + 4)));
+}
+
+#endif
+
+static inline short f32_to_s16(float x)
+{
+    float v = x*32768.0f;
+    if (!(v > -32768.0f))
+        v = -32768.0f;
+    else if (v > 32767.0f)
+        v = 32767.0f;
+    return (short)(int)((v + ROUND_MAGIC) - ROUND_MAGIC);
+}
+
+int pcm_format_bytes(pcm_format_t format)
+{
+    switch (format) {
+    case PCM_FORMAT_S16:     return 2;
+    case PCM_FORMAT_S24_3LE: return 3;
+    case PCM_FORMAT_S32:     return 4;
+    case PCM_FORMAT_F32:     return 4;
+    default:                 return -1;
+    }
+}
+
+int pcm_convert_s16(const void *in, pcm_format_t format, int samples, short *out)
+{
+    if (in == NULL || out == NULL || samples < 0)
+        return -1;
+
+    int i = 0;
+    switch (format) {
+    case PCM_FORMAT_S16:
+        memcpy(out, in, samples*sizeof(short));
+        break;
+    case PCM_FORMAT_S24_3LE: {
+        // byte gather, left to the compiler
+        const unsigned char *src = (const unsigned char *)in;
+        for (; i < samples; i++)
+            out[i] = (short)(src[i*3 + 1] | (src[i*3 + 2] << 8));
+        break;
+    }
+    case PCM_FORMAT_S32: {
+        const int32_t *src = (const int32_t *)in;
+#if defined(CONVERT_SIMD)
+        for (; i + VEC_SAMPLES <= samples; i += VEC_SAMPLES)
+            vec_s32_to_s16(&src[i], &out[i]);
+#endif
+        for (; i < samples; i++)
+            out[i] = (short)(src[i] >> 16);
+        break;
+    }
+    case PCM_FORMAT_F32: {
+        const float *src = (const float *)in;
+#if defined(CONVERT_SIMD)
+        for (; i + VEC_SAMPLES <= samples; i += VEC_SAMPLES)
+            vec_f32_to_s16(&src[i], &out[i]);
+#endif
+        for (; i < samples; i++)
+            out[i] = f32_to_s16(src[i]);
+        break;
+    }
+    default:
+        return -1;
+    }
+    return samples;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PCM_CONVERT_H__
+#define __PCM_CONVERT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    PCM_FORMAT_S16 = 0,         // 16-bit signed
+    PCM_FORMAT_S24_3LE = 1,     // 24-bit signed, packed in 3 bytes, little endian
+    PCM_FORMAT_S32 = 2,         // 32-bit signed
+    PCM_FORMAT_F32 = 3,         // 32-bit float, full scale is [-1.0, 1.0]
+} pcm_format_t;
+
+// Bytes per sample of format, -1 if format is invalid
+int pcm_format_bytes(pcm_format_t format);
+
+// Convert samples of any format to 16-bit, integer formats keep their top
+// 16 bits, float is scaled by 32768, rounded to nearest even and saturated.
+// S32/F32 run on SSE2/AVX2/NEON kernels when available at compile time.
+// in and out must not overlap, out holds at least samples samples.
+// Returns samples written, -1 if parameters are invalid.
+int pcm_convert_s16(const void *in, pcm_format_t format, int samples, short *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PCM_CONVERT_H__
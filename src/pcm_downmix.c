@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pcm_downmix.h"
+
+// Stereo kernels are selected at compile time, all of them give the same
+// result as the scalar code below. PCM_DISABLE_SIMD keeps the scalar code,
+// as a reference for tests.
+#if defined(PCM_DISABLE_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define DOWNMIX_SIMD 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DOWNMIX_SIMD 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DOWNMIX_SIMD 1
+#endif
+
+// Frames summed into 32-bit simd accumulators before they are folded into
+// 64-bit, far below the overflow bound of 2^31/(2*32767) vectors
+#define ENERGY_CHUNK_FRAMES 32768
+
+#if defined(DOWNMIX_SIMD) && defined(__AVX2__)
+
+#define VEC_FRAMES 16
+typedef __m256i vec_t;
+typedef __m256i vec_acc_t;
+
+static inline void vec_deinterleave(const short *in, vec_t *l, vec_t *r)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)in);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(in + 16));
+    // sign-extend each channel into 32-bit lanes, pack back and undo the
+    // per-128-bit-lane interleaving of packs
+    __m256i la = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+    __m256i lb = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+    __m256i ra = _mm256_srai_epi32(a, 16);
+    __m256i rb = _mm256_srai_epi32(b, 16);
+    *l = _mm256_permute4x64_epi64(_mm256_packs_epi32(la, lb), 0xD8);
+    *r = _mm256_permute4x64_epi64(_mm256_packs_epi32(ra, rb), 0xD8);
+}
+
+static inline void vec_store(short *out, vec_t v)
+{
+    _mm256_storeu_si256((__m256i *)out, v);
+}
+
+static inline vec_t vec_average(vec_t l, vec_t r)
+{
+    // floor((l+r)/2) without widening
+    return _mm256_add_epi16(_mm256_and_si256(l, r),
+                            _mm256_srai_epi16(_mm256_xor_si256(l, r), 1));
+}
+
+static inline vec_acc_t vec_acc_abs(vec_acc_t acc, vec_t v)
+{
+    __m256i abs = _mm256_max_epi16(v, _mm256_subs_epi16(_mm256_setzero_si256(), v));
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(abs, _mm256_set1_epi16(1)));
+}
+
+static inline vec_acc_t vec_acc_zero(void)
+{
+    return _mm256_setzero_si256();
+}
+
+static inline int64_t vec_acc_sum(vec_acc_t acc)
+{
+    int32_t lanes[8];
+    int64_t sum = 0;
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    for (int i = 0; i < 8; i++)
+        sum += lanes[i];
+    return sum;
+}
+
+#elif defined(DOWNMIX_SIMD) && defined(__SSE2__)
+
+#define VEC_FRAMES 8
+typedef __m128i vec_t;
+typedef __m128i vec_acc_t;
+
+static inline void vec_deinterleave(const short *in, vec_t *l, vec_t *r)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)in);
+    __m128i b = _mm_loadu_si128((const __m128i *)(in + 8));
+    // sign-extend each channel into 32-bit lanes and pack back
+    __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    __m128i ra = _mm_srai_epi32(a, 16);
+    __m128i rb = _mm_srai_epi32(b, 16);
+    *l = _mm_packs_epi32(la, lb);
+    *r = _mm_packs_epi32(ra, rb);
+}
+
+static inline void vec_store(short *out, vec_t v)
+{
+    _mm_storeu_si128((__m128i *)out, v);
+}
+
+static inline vec_t vec_average(vec_t l, vec_t r)
+{
+    // floor((l+r)/2) without widening
+    return _mm_add_epi16(_mm_and_si128(l, r), _mm_srai_epi16(_mm_xor_si128(l, r), 1));
+}
+
+static inline vec_acc_t vec_acc_abs(vec_acc_t acc, vec_t v)
+{
+    __m128i abs = _mm_max_epi16(v, _mm_subs_epi16(_mm_setzero_si128(), v));
+    return _mm_add_epi32(acc, _mm_madd_epi16(abs, _mm_set1_epi16(1)));
+}
+
+static inline vec_acc_t vec_acc_zero(void)
+{
+    return _mm_setzero_si128();
+}
+
+static inline int64_t vec_acc_sum(vec_acc_t acc)
+{
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#elif defined(DOWNMIX_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+
+#define VEC_FRAMES 8
+typedef int16x8_t vec_t;
+typedef int32x4_t vec_acc_t;
+
+static inline void vec_deinterleave(const short *in, vec_t *l, vec_t *r)
+{
+    int16x8x2_t v = vld2q_s16(in);
+    *l = v.val[0];
+    *r = v.val[1];
+}
+
+static inline void vec_store(short *out, vec_t v)
+{
+    vst1q_s16(out, v);
+}
+
+static inline vec_t vec_average(vec_t l, vec_t r)
+{
+    return vhaddq_s16(l, r);
+}
+
+static inline vec_acc_t vec_acc_abs(vec_acc_t acc, vec_t v)
+{
+    return vpadalq_s16(acc, vqabsq_s16(v));
+}
+
+static inline vec_acc_t vec_acc_zero(void)
+{
+    return vdupq_n_s32(0);
+}
+
+static inline int64_t vec_acc_sum(vec_acc_t acc)
+{
+    return (int64_t)vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1) +
+           vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+}
+
+#endif
+
+static inline short average2(short l, short r)
+{
+    return (short)(((int)l + (int)r) >> 1);
+}
+
+static inline int abs_sat(short v)
+{
+    return v == -32768 ? 32767 : (v < 0 ? -v : v);
+}
+
+// Copy one channel out of interleaved data
+static void extract_channel(const short *in, int frames, int channels, int index, short *out)
+{
+    int i = 0;
+#if defined(DOWNMIX_SIMD)
+    if (channels == 2) {
+        vec_t l, r;
+        for (; i + VEC_FRAMES <= frames; i += VEC_FRAMES) {
+            vec_deinterleave(&in[i*2], &l, &r);
+            vec_store(&out[i], index == 0 ? l : r);
+        }
+    }
+#endif
+    for (; i < frames; i++)
+        out[i] = in[i*channels + index];
+}
+
+static void average_channels(const short *in, int frames, int channels, short *out)
+{
+    int i = 0;
+    if (channels == 2) {
+#if defined(DOWNMIX_SIMD)
+        vec_t l, r;
+        for (; i + VEC_FRAMES <= frames; i += VEC_FRAMES) {
+            vec_deinterleave(&in[i*2], &l, &r);
+            vec_store(&out[i], vec_average(l, r));
+        }
+#endif
+        for (; i < frames; i++)
+            out[i] = average2(in[i*2], in[i*2 + 1]);
+        return;
+    }
+
+    // generic layout, every frame is read once
+    for (; i < frames; i++) {
+        const short *frame = &in[i*channels];
+        int sum = 0;
+        for (int ch = 0; ch < channels; ch++)
+            sum += frame[ch];
+        // round toward -inf like the stereo path
+        out[i] = (short)(sum >= 0 ? sum/channels : -((-sum + channels - 1)/channels));
+    }
+}
+
+static int loudest_channel(const short *in, int frames, int channels)
+{
+    int64_t energy[channels];
+    int i = 0;
+    memset(energy, 0, sizeof(energy));
+
+#if defined(DOWNMIX_SIMD)
+    if (channels == 2) {
+        while (i + VEC_FRAMES <= frames) {
+            int end = frames - (frames - i) % VEC_FRAMES;
+            if (end - i > ENERGY_CHUNK_FRAMES)
+                end = i + ENERGY_CHUNK_FRAMES;
+            vec_acc_t accl = vec_acc_zero(), accr = vec_acc_zero();
+            vec_t l, r;
+            for (; i < end; i += VEC_FRAMES) {
+                vec_deinterleave(&in[i*2], &l, &r);
+                accl = vec_acc_abs(accl, l);
+                accr = vec_acc_abs(accr, r);
+            }
+            energy[0] += vec_acc_sum(accl);
+            energy[1] += vec_acc_sum(accr);
+        }
+    }
+#endif
+    for (; i < frames; i++) {
+        for (int ch = 0; ch < channels; ch++)
+            energy[ch] += abs_sat(in[i*channels + ch]);
+    }
+
+    // first channel wins ties
+    int loudest = 0;
+    for (int ch = 1; ch < channels; ch++) {
+        if (energy[ch] > energy[loudest])
+            loudest = ch;
+    }
+    return loudest;
+}
+
+int pcm_downmix_s16(const short *in, int frames, int channels,
+                    pcm_downmix_policy_t policy, short *out)
+{
+    if (in == NULL || out == NULL || frames < 0 || channels <= 0)
+        return -1;
+
+    if (channels == 1) {
+        memcpy(out, in, frames*sizeof(short));
+        return frames;
+    }
+
+    switch (policy) {
+    case PCM_DOWNMIX_AVERAGE:
+        average_channels(in, frames, channels, out);
+        break;
+    case PCM_DOWNMIX_LEFT:
+        extract_channel(in, frames, channels, 0, out);
+        break;
+    case PCM_DOWNMIX_RIGHT:
+        extract_channel(in, frames, channels, 1, out);
+        break;
+    case PCM_DOWNMIX_MAX_ENERGY:
+        extract_channel(in, frames, channels, loudest_channel(in, frames, channels), out);
+        break;
+    default:
+        return -1;
+    }
+    return frames;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PCM_DOWNMIX_H__
+#define __PCM_DOWNMIX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    PCM_DOWNMIX_AVERAGE = 0,    // mean of all channels, rounded toward -inf
+    PCM_DOWNMIX_LEFT = 1,       // first channel
+    PCM_DOWNMIX_RIGHT = 2,      // second channel, first one if mono
+    PCM_DOWNMIX_MAX_ENERGY = 3, // channel with the largest sum of |sample| in the block
+} pcm_downmix_policy_t;
+
+// Downmix interleaved 16-bit pcm of any channel count to mono, stereo input
+// runs on SSE2/AVX2/NEON kernels when available at compile time.
+// in and out must not overlap, out holds at least frames samples.
+// Returns frames written, -1 if parameters are invalid.
+int pcm_downmix_s16(const short *in, int frames, int channels,
+                    pcm_downmix_policy_t policy, short *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PCM_DOWNMIX_H__
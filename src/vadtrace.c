@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "vadtrace.h"
+#include "logger.h"
+
+#define TAG "vadtrace"
+
+#define TRACE_FILE_VERSION      1
+// Records per thread buffer, power of 2
+#define THREAD_BUFFER_RECORDS   4096
+// Period of background writer
+#define DRAIN_PERIOD_MS         50
+
+// Single producer (owner thread), single consumer (writer thread) ring
+struct thread_buffer {
+    vadtrace_record_t     records[THREAD_BUFFER_RECORDS];
+    atomic_uint           head;
+    atomic_uint           tail;
+    atomic_uint           dropped;
+    unsigned int          dropped_reported;
+    atomic_bool           exited;   // owner thread exited, freed once drained
+    uint32_t              thread_id;
+    struct thread_buffer *next;
+};
+
+static struct {
+    atomic_bool           running;
+    pthread_mutex_t       lock;     // buffer list and file
+    pthread_cond_t        cond;
+    struct thread_buffer *buffers;
+    uint32_t              thread_count;
+    FILE                 *file;
+    pthread_t             writer;
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread struct thread_buffer *tls_buffer;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static void thread_exited(void *arg)
+{
+    struct thread_buffer *tb = (struct thread_buffer *)arg;
+    atomic_store(&tb->exited, true);
+}
+
+static void create_exit_key(void)
+{
+    pthread_key_create(&exit_key, thread_exited);
+}
+
+static struct thread_buffer *register_thread(void)
+{
+    pthread_once(&exit_key_once, create_exit_key);
+    struct thread_buffer *tb = calloc(1, sizeof(struct thread_buffer));
+    if (tb == NULL)
+        return NULL;
+    pthread_mutex_lock(&trace.lock);
+    tb->thread_id = trace.thread_count++;
+    tb->next = trace.buffers;
+    trace.buffers = tb;
+    pthread_mutex_unlock(&trace.lock);
+    pthread_setspecific(exit_key, tb);
+    tls_buffer = tb;
+    return tb;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void vadtrace_emit(int event, int64_t arg0, int64_t arg1)
+{
+    if (!atomic_load_explicit(&trace.running, memory_order_relaxed))
+        return;
+    struct thread_buffer *tb = tls_buffer;
+    if (tb == NULL && (tb = register_thread()) == NULL)
+        return;
+
+    unsigned int head = atomic_load_explicit(&tb->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&tb->tail, memory_order_acquire);
+    if (head - tail >= THREAD_BUFFER_RECORDS) {
+        atomic_store_explicit(&tb->dropped,
+                              atomic_load_explicit(&tb->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    vadtrace_record_t *r = &tb->records[head & (THREAD_BUFFER_RECORDS - 1)];
+    r->timestamp_ns = now_ns();
+    r->thread_id = tb->thread_id;
+    r->event = (uint16_t)event;
+    r->reserved = 0;
+    r->arg0 = arg0;
+    r->arg1 = arg1;
+    atomic_store_explicit(&tb->head, head + 1, memory_order_release);
+}
+
+// Called with trace.lock held
+static void drain_buffers(void)
+{
+    struct thread_buffer **link = &trace.buffers;
+    while (*link != NULL) {
+        struct thread_buffer *tb = *link;
+        bool exited = atomic_load(&tb->exited);
+        unsigned int head = atomic_load_explicit(&tb->head, memory_order_acquire);
+        unsigned int tail = atomic_load_explicit(&tb->tail, memory_order_relaxed);
+        while (tail != head) {
+            unsigned int index = tail & (THREAD_BUFFER_RECORDS - 1);
+            unsigned int count = head - tail;
+            if (count > THREAD_BUFFER_RECORDS - index)
+                count = THREAD_BUFFER_RECORDS - index;
+            fwrite(&tb->records[index], sizeof(vadtrace_record_t), count, trace.file);
+            tail += count;
+        }
+        atomic_store_explicit(&tb->tail, tail, memory_order_release);
+
+        unsigned int dropped = atomic_load_explicit(&tb->dropped, memory_order_relaxed);
+        if (dropped != tb->dropped_reported) {
+            vadtrace_record_t r = { now_ns(), tb->thread_id, VADTRACE_DROPPED, 0,
+                                    dropped - tb->dropped_reported, 0 };
+            fwrite(&r, sizeof(r), 1, trace.file);
+            tb->dropped_reported = dropped;
+        }
+
+        if (exited) {
+            *link = tb->next;
+            free(tb);
+        } else {
+            link = &tb->next;
+        }
+    }
+}
+
+static void *writer_loop(void *arg)
+{
+    pthread_mutex_lock(&trace.lock);
+    while (atomic_load(&trace.running)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += DRAIN_PERIOD_MS*1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&trace.cond, &trace.lock, &ts);
+        drain_buffers();
+    }
+    pthread_mutex_unlock(&trace.lock);
+    return NULL;
+}
+
+int vadtrace_start(const char *path)
+{
+    if (atomic_load(&trace.running)) {
+        pr_err("Trace already started");
+        return -1;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        pr_err("Failed to open trace file: %s", path);
+        return -1;
+    }
+    uint32_t header[3] = { 0, TRACE_FILE_VERSION, sizeof(vadtrace_record_t) };
+    memcpy(&header[0], "VTRC", 4);
+    fwrite(header, sizeof(header), 1, file);
+
+    pthread_mutex_lock(&trace.lock);
+    trace.file = file;
+    pthread_mutex_unlock(&trace.lock);
+    atomic_store(&trace.running, true);
+    if (pthread_create(&trace.writer, NULL, writer_loop, NULL) != 0) {
+        pr_err("Failed to create trace writer");
+        atomic_store(&trace.running, false);
+        fclose(file);
+        trace.file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void vadtrace_stop(void)
+{
+    if (!atomic_load(&trace.running))
+        return;
+    pthread_mutex_lock(&trace.lock);
+    atomic_store(&trace.running, false);
+    pthread_cond_signal(&trace.cond);
+    pthread_mutex_unlock(&trace.lock);
+    pthread_join(trace.writer, NULL);
+
+    // Records emitted while stopping may be lost
+    pthread_mutex_lock(&trace.lock);
+    drain_buffers();
+    fclose(trace.file);
+    trace.file = NULL;
+    pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __VADTRACE_H__
+#define __VADTRACE_H__
+
+#include <stdint.h>
+
+// Trace points above VADTRACE_LEVEL compile to nothing, arguments included:
+//   0: off
+//   1: segment, speech likely/cancelled/begin/end, pre-roll flush, dropped data
+//   2: stage, feed/VAD/encode/listener calls
+//   3: frame, every VAD decision
+#ifndef VADTRACE_LEVEL
+#define VADTRACE_LEVEL 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    VADTRACE_DROPPED = 0,       // arg0: records lost as thread buffer was full
+    VADTRACE_FEED,              // arg0: bytes
+    VADTRACE_VAD_BEGIN,         // arg0: frames of batch
+    VADTRACE_VAD_END,           // arg0: frames analyzed
+    VADTRACE_LITEVAD_FRAME,     // arg0: webrtc vad decision, arg1: speech weight
+    VADTRACE_SPEECH_BEGIN,      // arg0: active time in ms, arg1: speech weight
+    VADTRACE_SPEECH_END,        // arg0: silence time in ms, arg1: speech weight
+    VADTRACE_PREROLL_FLUSH,     // arg0: bytes, arg1: 1 if already encoded
+    VADTRACE_ENCODE_BEGIN,      // arg0: bytes
+    VADTRACE_ENCODE_END,        // arg0: encoder result
+    VADTRACE_QUEUE_DROP,        // arg0: bytes
+    VADTRACE_LISTENER_BEGIN,    // arg0: output bytes, arg1: event flags
+    VADTRACE_LISTENER_END,
+    VADTRACE_ENGINE_TURN,       // arg0: bytes, arg1: worker index
+    VADTRACE_SPEECH_LIKELY,     // arg0: active time in ms, arg1: speech weight
+    VADTRACE_SPEECH_CANCELLED,  // arg0: silence time in ms
+} vadtrace_event_t;
+
+// Record of trace file, the file starts with "VTRC", version and record
+// size as uint32_t, all in host byte order
+typedef struct {
+    uint64_t timestamp_ns;      // CLOCK_MONOTONIC
+    uint32_t thread_id;         // threads are numbered in order of first record
+    uint16_t event;             // vadtrace_event_t
+    uint16_t reserved;
+    int64_t  arg0;
+    int64_t  arg1;
+} vadtrace_record_t;
+
+// Start writing records to file, records are buffered per thread and written
+// by a background thread. Returns 0 on success.
+int vadtrace_start(const char *path);
+
+// Write pending records and close file.
+void vadtrace_stop(void);
+
+// Use the level macros below instead, so that disabled trace points cost nothing.
+void vadtrace_emit(int event, int64_t arg0, int64_t arg1);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if VADTRACE_LEVEL >= 1
+#define vadtrace_segment(event, arg0, arg1) vadtrace_emit(event, arg0, arg1)
+#else
+#define vadtrace_segment(event, arg0, arg1) do {} while (0)
+#endif
+
+#if VADTRACE_LEVEL >= 2
+#define vadtrace_stage(event, arg0, arg1) vadtrace_emit(event, arg0, arg1)
+#else
+#define vadtrace_stage(event, arg0, arg1) do {} while (0)
+#endif
+
+#if VADTRACE_LEVEL >= 3
+#define vadtrace_frame(event, arg0, arg1) vadtrace_emit(event, arg0, arg1)
+#else
+#define vadtrace_frame(event, arg0, arg1) do {} while (0)
+#endif
+
+#endif // __VADTRACE_H__
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the eos silence time decides when speech ends, for short times
+// as well as for those the speech weight alone would cut short.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "litevad.h"
+#include "vad_test_signal.h"
+
+#define SAMPLE_RATE  16000
+#define FRAME_TIME   10
+#define FRAME_SIZE   (SAMPLE_RATE/1000*FRAME_TIME)
+#define SPEECH_TIME  1500
+#define MAX_TIME     5000
+
+// Voiced harmonics over a low noise floor while voiced, else the floor alone
+static void make_frame(struct vad_test_signal *sig, int voiced, int16_t *out)
+{
+    for (int i = 0; i < FRAME_SIZE; i++) {
+        int value = vad_test_noise(sig, 40);
+        if (voiced) {
+            sig->phase += 2*M_PI*180/SAMPLE_RATE;
+            for (int h = 1; h < 10; h++)
+                value += (int)(sin(sig->phase*h)*6000/h);
+        }
+        out[i] = vad_test_clip(value);
+    }
+}
+
+// Silence in ms from the end of the voiced signal to speech end, -1 if speech
+// never began or ended
+static int speech_end_time(int eos_silence_time)
+{
+    litevad_handle_t handle = litevad_create(SAMPLE_RATE, 1, 16, FRAME_TIME);
+    if (handle == NULL)
+        return -1;
+    litevad_config_t config;
+    litevad_get_config(handle, &config);
+    config.eos_adaptive = 0;
+    config.eos_silence_time = eos_silence_time;
+    if (litevad_set_config(handle, &config) != 0) {
+        litevad_destroy(handle);
+        return -1;
+    }
+
+    struct vad_test_signal sig;
+    vad_test_signal_init(&sig, 0);
+    int16_t frame[FRAME_SIZE];
+    int began = 0, end_time = -1;
+    for (int t = 0; t < SPEECH_TIME + MAX_TIME; t += FRAME_TIME) {
+        make_frame(&sig, t < SPEECH_TIME, frame);
+        litevad_result_t ret = litevad_process(handle, frame, sizeof(frame));
+        if (ret == LITEVAD_RESULT_SPEECH_BEGIN) {
+            began = 1;
+        }
+        else if (ret == LITEVAD_RESULT_SPEECH_END && began) {
+            end_time = t + FRAME_TIME - SPEECH_TIME;
+            break;
+        }
+    }
+    litevad_destroy(handle);
+    return end_time;
+}
+
+int main()
+{
+    static const int eos_times[] = { 300, 700, 1500, 2000 };
+    int last = -1;
+    for (size_t i = 0; i < sizeof(eos_times)/sizeof(eos_times[0]); i++) {
+        int end_time = speech_end_time(eos_times[i]);
+        if (end_time < eos_times[i] || end_time <= last) {
+            fprintf(stderr, "eos silence time %dms: speech ended after %dms of silence\n",
+                    eos_times[i], end_time);
+            return 1;
+        }
+        printf("eos silence time %dms: speech ended after %dms of silence\n",
+               eos_times[i], end_time);
+        last = end_time;
+    }
+    printf("litevad_test: speech ends after the eos silence time\n");
+    return 0;
+}
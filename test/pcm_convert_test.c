@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the S32/F32 conversion of the library, on the kernels where the
+// target has them, gives the same samples as the scalar code, which is built
+// here from the same pcm_convert.c with PCM_DISABLE_SIMD.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pcm_convert.h"
+
+#define PCM_DISABLE_SIMD
+#define pcm_format_bytes scalar_format_bytes
+#define pcm_convert_s16  scalar_convert_s16
+#include "pcm_convert.c"
+#undef pcm_format_bytes
+#undef pcm_convert_s16
+
+#define MAX_SAMPLES 4096
+
+static uint32_t seed = 1;
+
+static uint32_t random_u32(void)
+{
+    seed = seed*1664525u + 1013904223u;
+    return seed ^ (seed >> 15);
+}
+
+// Edge values first, each of them lands on every lane and in the tail as the
+// buffer is shifted, then random ones
+static const int32_t s32_edges[] = {
+    0, 1, -1, 65535, 65536, -65536, -65537, 0x7FFF0000, 0x7FFFFFFF,
+    (int32_t)0x80000000, (int32_t)0x80000001, (int32_t)0x8000FFFF,
+};
+
+static const float f32_edges[] = {
+    0.0f, -0.0f, 1.0f, -1.0f, 1.0000001f, -1.0000001f, 1.5f, -1.5f, 1e30f, -1e30f,
+    32767.0f/32768, 32767.5f/32768, -32767.5f/32768, -32768.5f/32768,
+    0.5f/32768, 1.5f/32768, 2.5f/32768, -0.5f/32768, -1.5f/32768, -2.5f/32768,
+    1e-40f, -1e-40f, INFINITY, -INFINITY, NAN, -NAN,
+};
+
+static void make_s32(int32_t *in, int samples, int shift)
+{
+    int edges = sizeof(s32_edges)/sizeof(s32_edges[0]);
+    for (int i = 0; i < samples; i++)
+        in[i] = (i + shift)%(2*edges) < edges ? s32_edges[(i + shift)%edges] : (int32_t)random_u32();
+}
+
+static void make_f32(float *in, int samples, int shift)
+{
+    int edges = sizeof(f32_edges)/sizeof(f32_edges[0]);
+    for (int i = 0; i < samples; i++) {
+        // random ones around full scale, a sixth of them out of range
+        in[i] = (i + shift)%(2*edges) < edges ? f32_edges[(i + shift)%edges] :
+                ((int)(random_u32()%2400001) - 1200000)/1000000.0f;
+    }
+}
+
+static int check(const void *in, pcm_format_t format, int samples, int shift)
+{
+    static short out[MAX_SAMPLES + 1], ref[MAX_SAMPLES + 1];
+    memset(out, 0x55, sizeof(out));
+    memset(ref, 0x55, sizeof(ref));
+    int ret = pcm_convert_s16(in, format, samples, out);
+    int ref_ret = scalar_convert_s16(in, format, samples, ref);
+    // one more sample than written, which must stay untouched
+    if (ret != ref_ret || memcmp(out, ref, (samples + 1)*sizeof(short)) != 0) {
+        int i = 0;
+        while (i <= samples && out[i] == ref[i])
+            i++;
+        fprintf(stderr, "format %d, samples %d, shift %d: returned %d/%d, sample %d is %d/%d",
+                format, samples, shift, ret, ref_ret, i, out[i], ref[i]);
+        if (i < samples && format == PCM_FORMAT_F32)
+            fprintf(stderr, " of %.9g", ((const float *)in)[i]);
+        else if (i < samples)
+            fprintf(stderr, " of %d", ((const int32_t *)in)[i]);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    // room for one sample of offset, so that loads are unaligned
+    static int32_t s32[MAX_SAMPLES + 1];
+    static float f32[MAX_SAMPLES + 1];
+
+    int cases = 0;
+    for (int offset = 0; offset <= 1; offset++) {
+        for (int samples = 0; samples <= MAX_SAMPLES; samples += samples < 70 ? 1 : 1001) {
+            for (int shift = 0; shift < 16; shift++) {
+                make_s32(&s32[offset], samples, shift);
+                make_f32(&f32[offset], samples, shift);
+                if (check(&s32[offset], PCM_FORMAT_S32, samples, shift) != 0 ||
+                    check(&f32[offset], PCM_FORMAT_F32, samples, shift) != 0)
+                    return 1;
+                cases += 2;
+            }
+        }
+    }
+    printf("pcm_convert_test: %d cases, S32 and F32 match the scalar code\n", cases);
+    return 0;
+}
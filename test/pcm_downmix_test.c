@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the downmix of the library, on the stereo kernels where the
+// target has them, gives the same samples and loudest channel as the scalar
+// code, which is built here from the same pcm_downmix.c with PCM_DISABLE_SIMD.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm_downmix.h"
+
+#define PCM_DISABLE_SIMD
+#define pcm_downmix_s16 scalar_downmix_s16
+#include "pcm_downmix.c"
+#undef pcm_downmix_s16
+
+// Longer than the chunk the energy is summed in by the stereo kernels
+#define MAX_FRAMES   (ENERGY_CHUNK_FRAMES*3 + 5)
+#define MAX_CHANNELS 4
+
+static uint32_t seed = 1;
+
+static short random_sample(void)
+{
+    seed = seed*1664525u + 1013904223u;
+    return (short)(seed >> 16);
+}
+
+enum {
+    SIGNAL_RANDOM,      // full scale noise on every channel
+    SIGNAL_FULL_SCALE,  // -32768 and 32767 only, the sums and |x| saturate
+    SIGNAL_MIN_VS_MAX,  // -32768 against 32767, equal energy, first channel wins
+    SIGNAL_NEAR_TIE,    // channels equal but one sample of the last channel
+    SIGNAL_COUNT,
+};
+
+static void make_signal(int kind, short *in, int frames, int channels)
+{
+    for (int i = 0; i < frames; i++) {
+        for (int ch = 0; ch < channels; ch++) {
+            short *s = &in[i*channels + ch];
+            switch (kind) {
+            case SIGNAL_RANDOM:
+                *s = random_sample();
+                break;
+            case SIGNAL_FULL_SCALE:
+                *s = random_sample() < 0 ? -32768 : 32767;
+                break;
+            case SIGNAL_MIN_VS_MAX:
+                *s = ch == 0 ? -32768 : 32767;
+                break;
+            case SIGNAL_NEAR_TIE:
+                *s = (short)(i*97%2001 - 1000);
+                break;
+            }
+        }
+    }
+    if (kind == SIGNAL_NEAR_TIE && frames > 0)
+        in[(frames - 1)*channels + channels - 1] += 1;
+}
+
+static int check(const short *in, int frames, int channels, int kind)
+{
+    static short out[MAX_FRAMES + 1], ref[MAX_FRAMES + 1];
+    for (int policy = PCM_DOWNMIX_AVERAGE; policy <= PCM_DOWNMIX_MAX_ENERGY; policy++) {
+        memset(out, 0x55, sizeof(out));
+        memset(ref, 0x55, sizeof(ref));
+        int ret = pcm_downmix_s16(in, frames, channels, (pcm_downmix_policy_t)policy, out);
+        int ref_ret = scalar_downmix_s16(in, frames, channels, (pcm_downmix_policy_t)policy, ref);
+        // one more sample than written, which must stay untouched
+        if (ret != ref_ret || memcmp(out, ref, (frames + 1)*sizeof(short)) != 0) {
+            int i = 0;
+            while (i <= frames && out[i] == ref[i])
+                i++;
+            fprintf(stderr, "channels %d, frames %d, signal %d, policy %d: "
+                    "returned %d/%d, sample %d is %d/%d\n",
+                    channels, frames, kind, policy, ret, ref_ret, i, out[i], ref[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    static const int long_frames[] = {
+        1000, 1023, ENERGY_CHUNK_FRAMES - 1, ENERGY_CHUNK_FRAMES + 1, MAX_FRAMES,
+    };
+    // room for an odd frame offset, so that loads are unaligned
+    short *buffer = malloc((MAX_FRAMES + 1)*MAX_CHANNELS*sizeof(short));
+    if (buffer == NULL)
+        return 1;
+
+    int cases = 0;
+    for (int channels = 1; channels <= MAX_CHANNELS; channels++) {
+        for (int kind = 0; kind < SIGNAL_COUNT; kind++) {
+            for (int offset = 0; offset <= 1; offset++) {
+                short *in = &buffer[offset*channels];
+                // every length around the kernel widths, then long ones
+                for (int frames = 0; frames <= 70; frames++) {
+                    make_signal(kind, in, frames, channels);
+                    if (check(in, frames, channels, kind) != 0) {
+                        free(buffer);
+                        return 1;
+                    }
+                    cases++;
+                }
+                for (size_t i = 0; i < sizeof(long_frames)/sizeof(long_frames[0]); i++) {
+                    make_signal(kind, in, long_frames[i], channels);
+                    if (check(in, long_frames[i], channels, kind) != 0) {
+                        free(buffer);
+                        return 1;
+                    }
+                    cases++;
+                }
+            }
+        }
+    }
+    free(buffer);
+    printf("pcm_downmix_test: %d cases, every policy matches the scalar code\n", cases);
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput of the batch paths against the scalar path, in frames per second
+// of one thread. Usage: vad_bench [streams] [frames]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vad_core.h"
+#include "vad_filterbank.h"
+#include "litevad.h"
+#include "vad_test_signal.h"
+
+#define MAX_STREAMS 128
+// Distinct input frames of each stream, replayed in a loop
+#define SIGNAL_FRAMES 50
+
+static VadInstT insts[MAX_STREAMS];
+static int16_t signal[MAX_STREAMS][SIGNAL_FRAMES][480];
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void make_signal(int streams, int sample_rate, size_t length)
+{
+    for (int i = 0; i < streams; i++) {
+        struct vad_test_signal sig;
+        vad_test_signal_init(&sig, i);
+        for (int f = 0; f < SIGNAL_FRAMES; f++)
+            vad_test_signal_frame(&sig, sample_rate, signal[i][f], length);
+    }
+}
+
+// Frames per second of WebRtcVad_CalculateFeaturesBatch() over all streams
+static double bench_features(int streams, int frames, size_t length)
+{
+    VadInstT *ptrs[MAX_STREAMS];
+    const int16_t *data_in[MAX_STREAMS];
+    int16_t features[MAX_STREAMS][kNumChannels];
+    int16_t energy[MAX_STREAMS];
+
+    for (int i = 0; i < streams; i++) {
+        WebRtcVad_InitCore(&insts[i]);
+        ptrs[i] = &insts[i];
+    }
+    double start = now_seconds();
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < streams; i++)
+            data_in[i] = signal[i][f%SIGNAL_FRAMES];
+        WebRtcVad_CalculateFeaturesBatch(ptrs, data_in, length, streams, features, energy);
+    }
+    return (double)streams*frames/(now_seconds() - start);
+}
+
+// Frames per second of 10ms litevad frames over all streams, with one
+// litevad_process() call per handle, or one litevad_process_batch() call for
+// all of them. Returns -1 on error.
+static double bench_litevad(int streams, int frames, int sample_rate, int batch)
+{
+    litevad_handle_t handles[MAX_STREAMS];
+    const void *buffs[MAX_STREAMS];
+    unsigned char results[MAX_STREAMS];
+    int frame_bytes = sample_rate/100*sizeof(int16_t);
+    double elapsed = -1;
+
+    for (int i = 0; i < streams; i++) {
+        handles[i] = litevad_create(sample_rate, 1, 16, 10);
+        if (handles[i] == NULL) {
+            while (--i >= 0)
+                litevad_destroy(handles[i]);
+            return -1;
+        }
+    }
+    // litevad logs speech begin and end to stdout, keep it out of the timing
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved_stdout >= 0 && null_fd >= 0)
+        dup2(null_fd, STDOUT_FILENO);
+
+    double start = now_seconds();
+    int f;
+    for (f = 0; f < frames; f++) {
+        if (batch) {
+            for (int i = 0; i < streams; i++)
+                buffs[i] = signal[i][f%SIGNAL_FRAMES];
+            if (litevad_process_batch(handles, buffs, streams, results, NULL) != 0)
+                break;
+        } else {
+            for (int i = 0; i < streams; i++)
+                litevad_process(handles[i], signal[i][f%SIGNAL_FRAMES], frame_bytes);
+        }
+    }
+    if (f == frames)
+        elapsed = now_seconds() - start;
+
+    fflush(stdout);
+    if (saved_stdout >= 0 && null_fd >= 0)
+        dup2(saved_stdout, STDOUT_FILENO);
+    if (saved_stdout >= 0)
+        close(saved_stdout);
+    if (null_fd >= 0)
+        close(null_fd);
+    for (int i = 0; i < streams; i++)
+        litevad_destroy(handles[i]);
+    return elapsed > 0 ? (double)streams*frames/elapsed : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int widths[] = { 1, 4, 8 };
+    static const size_t lengths[] = { 80, 160, 240 };
+    int streams = argc > 1 ? atoi(argv[1]) : 64;
+    int frames = argc > 2 ? atoi(argv[2]) : 2000;
+    if (streams < 1 || streams > MAX_STREAMS || frames < 1) {
+        fprintf(stderr, "Usage: %s [streams (1~%d)] [frames]\n", argv[0], MAX_STREAMS);
+        return 1;
+    }
+
+    printf("%d streams, %d frames each\n", streams, frames);
+    for (int l = 0; l < 3; l++) {
+        double scalar = 0;
+        make_signal(streams, 8000, lengths[l]);
+        for (int w = 0; w < 3; w++) {
+            if (WebRtcVad_SetBatchLanes(widths[w]) != widths[w])
+                continue;
+            double rate = bench_features(streams, frames, lengths[l]);
+            if (widths[w] == 1)
+                scalar = rate;
+            printf("features %3zu samples, %s: %10.0f frames/s, x%.2f\n", lengths[l],
+                   widths[w] == 1 ? "scalar " : widths[w] == 4 ? "4 lanes" : "8 lanes",
+                   rate, rate/scalar);
+        }
+    }
+    WebRtcVad_SetBatchLanes(0);
+
+    static const int sample_rates[] = { 8000, 16000, 32000, 48000 };
+    for (int r = 0; r < 4; r++) {
+        make_signal(streams, sample_rates[r], sample_rates[r]/100);
+        double single = bench_litevad(streams, frames, sample_rates[r], 0);
+        double batch = bench_litevad(streams, frames, sample_rates[r], 1);
+        if (single < 0 || batch < 0) {
+            fprintf(stderr, "litevad failed at %dHz\n", sample_rates[r]);
+            return 1;
+        }
+        printf("litevad %5dHz 10ms, per handle: %10.0f frames/s, batch: %10.0f frames/s, x%.2f\n",
+               sample_rates[r], single, batch, batch/single);
+    }
+    return 0;
+}
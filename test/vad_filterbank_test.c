@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the SIMD lane kernels of the filterbank and of the 16/32 kHz
+// downsampling give the same output and filter states as the scalar code, at
+// each lane width of the cpu.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vad_core.h"
+#include "vad_filterbank.h"
+#include "vad_sp.h"
+#include "vad_test_signal.h"
+
+// Odd count, so that every width also ends with a partial vector
+#define STREAMS 13
+#define FRAMES  300
+
+static VadInstT lane_insts[STREAMS];
+static VadInstT scalar_insts[STREAMS];
+
+static int same_filter_states(const VadInstT *a, const VadInstT *b)
+{
+    return memcmp(a->upper_state, b->upper_state, sizeof(a->upper_state)) == 0 &&
+           memcmp(a->lower_state, b->lower_state, sizeof(a->lower_state)) == 0 &&
+           memcmp(a->hp_filter_state, b->hp_filter_state, sizeof(a->hp_filter_state)) == 0;
+}
+
+static int test_features(int lanes, size_t length)
+{
+    struct vad_test_signal sigs[STREAMS];
+    int16_t frames[STREAMS][240];
+    const int16_t *data_in[STREAMS];
+    VadInstT *insts[STREAMS];
+    int16_t features[STREAMS][kNumChannels];
+    int16_t energy[STREAMS];
+
+    for (int i = 0; i < STREAMS; i++) {
+        WebRtcVad_InitCore(&lane_insts[i]);
+        WebRtcVad_InitCore(&scalar_insts[i]);
+        vad_test_signal_init(&sigs[i], i);
+        data_in[i] = frames[i];
+        insts[i] = &lane_insts[i];
+    }
+
+    for (int frame = 0; frame < FRAMES; frame++) {
+        // Fewer streams on some frames, for every size of the last vector
+        int count = STREAMS - frame%lanes;
+        for (int i = 0; i < count; i++)
+            vad_test_signal_frame(&sigs[i], 8000, frames[i], length);
+
+        WebRtcVad_CalculateFeaturesBatch(insts, data_in, length, count, features, energy);
+        for (int i = 0; i < count; i++) {
+            int16_t expected[kNumChannels];
+            int16_t expected_energy = WebRtcVad_CalculateFeatures(&scalar_insts[i], frames[i],
+                                                                  length, expected);
+            if (energy[i] != expected_energy ||
+                memcmp(features[i], expected, sizeof(expected)) != 0 ||
+                !same_filter_states(&lane_insts[i], &scalar_insts[i])) {
+                fprintf(stderr, "features of %d lanes differ: length %zu, frame %d, stream %d of %d\n",
+                        lanes, length, frame, i, count);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int test_downsampling(int lanes, int fs, size_t length)
+{
+    struct vad_test_signal sigs[STREAMS];
+    int16_t frames[STREAMS][960];
+    const int16_t *data_in[STREAMS];
+    VadInstT *insts[STREAMS];
+    int16_t out[STREAMS][240];
+    size_t out_length = length*8000/fs;
+
+    for (int i = 0; i < STREAMS; i++) {
+        WebRtcVad_InitCore(&lane_insts[i]);
+        WebRtcVad_InitCore(&scalar_insts[i]);
+        vad_test_signal_init(&sigs[i], i);
+        data_in[i] = frames[i];
+        insts[i] = &lane_insts[i];
+    }
+
+    for (int frame = 0; frame < FRAMES; frame++) {
+        int count = STREAMS - frame%lanes;
+        for (int i = 0; i < count; i++)
+            vad_test_signal_frame(&sigs[i], fs, frames[i], length);
+
+        WebRtcVad_DownsamplingBatch(insts, fs, data_in, length, count, out);
+        for (int i = 0; i < count; i++) {
+            int16_t expected[240];
+            if (fs == 32000) {
+                WebRtcVad_Downsampling32khz(frames[i], expected,
+                                            scalar_insts[i].downsampling_filter_states, length);
+            } else {
+                WebRtcVad_Downsampling(frames[i], expected,
+                                       scalar_insts[i].downsampling_filter_states, length);
+            }
+            if (memcmp(out[i], expected, out_length*sizeof(int16_t)) != 0 ||
+                memcmp(lane_insts[i].downsampling_filter_states,
+                       scalar_insts[i].downsampling_filter_states,
+                       sizeof(lane_insts[i].downsampling_filter_states)) != 0) {
+                fprintf(stderr, "%dHz downsampling of %d lanes differs: length %zu, frame %d, "
+                        "stream %d of %d\n", fs, lanes, length, frame, i, count);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    static const int widths[] = { 4, 8 };
+    static const size_t lengths[] = { 80, 160, 240 };
+    int tested = 0;
+
+    for (int w = 0; w < 2; w++) {
+        if (WebRtcVad_SetBatchLanes(widths[w]) != widths[w]) {
+            printf("%d lanes: not supported, skipped\n", widths[w]);
+            continue;
+        }
+        for (int l = 0; l < 3; l++) {
+            if (test_features(widths[w], lengths[l]) != 0 ||
+                test_downsampling(widths[w], 16000, lengths[l]*2) != 0 ||
+                test_downsampling(widths[w], 32000, lengths[l]*4) != 0)
+                return 1;
+        }
+        printf("%d lanes: features and downsampling match the scalar path\n", widths[w]);
+        tested++;
+    }
+    WebRtcVad_SetBatchLanes(0);
+    if (tested == 0)
+        printf("no lane kernels on this build or cpu\n");
+    return 0;
+}
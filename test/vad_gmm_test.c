@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the GMM of the library, in vector lanes where the target has
+// them, keeps the same model and decisions as the scalar code, which is built
+// here from the same vad_core.c with VAD_DISABLE_LANES.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vad_core.h"
+#include "vad_filterbank.h"
+#include "vad_gmm.h"
+#include "vad_sp.h"
+#include "vad_test_signal.h"
+
+// Scalar build of vad_core.c, with its external functions renamed. The
+// filterbank and minimum tracking are the library ones on both sides.
+#define VAD_DISABLE_LANES
+#define WebRtcVad_InitCore      ScalarVad_InitCore
+#define WebRtcVad_set_mode_core ScalarVad_set_mode_core
+#define WebRtcVad_CalcVad48khz  ScalarVad_CalcVad48khz
+#define WebRtcVad_CalcVad32khz  ScalarVad_CalcVad32khz
+#define WebRtcVad_CalcVad16khz  ScalarVad_CalcVad16khz
+#define WebRtcVad_CalcVad8khz   ScalarVad_CalcVad8khz
+#define WebRtcVad_CalcVadBatch  ScalarVad_CalcVadBatch
+// vad_core.h is already in, so its prototypes of the renamed functions are not
+int ScalarVad_InitCore(VadInstT* self);
+int ScalarVad_set_mode_core(VadInstT* self, int mode);
+int ScalarVad_CalcVad48khz(VadInstT* inst, const int16_t* speech_frame, size_t frame_length);
+int ScalarVad_CalcVad32khz(VadInstT* inst, const int16_t* speech_frame, size_t frame_length);
+int ScalarVad_CalcVad16khz(VadInstT* inst, const int16_t* speech_frame, size_t frame_length);
+int ScalarVad_CalcVad8khz(VadInstT* inst, const int16_t* speech_frame, size_t frame_length);
+void ScalarVad_CalcVadBatch(VadInstT* const* insts, int fs, const int16_t* const* speech_frames,
+                            size_t frame_length, int count, int* vads);
+#include "vad_core.c"
+#undef WebRtcVad_InitCore
+#undef WebRtcVad_set_mode_core
+#undef WebRtcVad_CalcVad48khz
+#undef WebRtcVad_CalcVad32khz
+#undef WebRtcVad_CalcVad16khz
+#undef WebRtcVad_CalcVad8khz
+#undef WebRtcVad_CalcVadBatch
+
+#define STREAMS 4
+#define FRAMES  2000
+
+static VadInstT lane_inst;
+static VadInstT scalar_inst;
+
+#define SAME_FIELD(a, b, field) (memcmp(&(a)->field, &(b)->field, sizeof((a)->field)) == 0)
+
+static int same_model(const VadInstT *a, const VadInstT *b)
+{
+    return SAME_FIELD(a, b, vad) && SAME_FIELD(a, b, noise_means) &&
+           SAME_FIELD(a, b, speech_means) && SAME_FIELD(a, b, noise_stds) &&
+           SAME_FIELD(a, b, speech_stds) && SAME_FIELD(a, b, frame_counter) &&
+           SAME_FIELD(a, b, over_hang) && SAME_FIELD(a, b, num_of_speech) &&
+           SAME_FIELD(a, b, index_vector) && SAME_FIELD(a, b, low_value_vector) &&
+           SAME_FIELD(a, b, mean_value) && SAME_FIELD(a, b, log_likelihood_ratio) &&
+           SAME_FIELD(a, b, likelihood_threshold);
+}
+
+static int test_gmm(int mode, size_t length, int stream)
+{
+    struct vad_test_signal sig;
+    int16_t frame[240];
+
+    WebRtcVad_InitCore(&lane_inst);
+    ScalarVad_InitCore(&scalar_inst);
+    WebRtcVad_set_mode_core(&lane_inst, mode);
+    ScalarVad_set_mode_core(&scalar_inst, mode);
+    vad_test_signal_init(&sig, stream);
+
+    for (int f = 0; f < FRAMES; f++) {
+        vad_test_signal_frame(&sig, 8000, frame, length);
+        int lane_vad = WebRtcVad_CalcVad8khz(&lane_inst, frame, length);
+        int scalar_vad = ScalarVad_CalcVad8khz(&scalar_inst, frame, length);
+        if (lane_vad != scalar_vad || !same_model(&lane_inst, &scalar_inst)) {
+            fprintf(stderr, "gmm differs: mode %d, length %zu, stream %d, frame %d\n",
+                    mode, length, stream, f);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    static const size_t lengths[] = { 80, 160, 240 };
+
+    for (int mode = 0; mode < 4; mode++) {
+        for (int l = 0; l < 3; l++) {
+            for (int i = 0; i < STREAMS; i++) {
+                if (test_gmm(mode, lengths[l], i) != 0)
+                    return 1;
+            }
+        }
+    }
+    printf("gmm matches the scalar code\n");
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the signal processing of the library against the scalar code, which
+// is built here from the same vad_sp.c with VAD_DISABLE_LANES.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vad_core.h"
+#include "vad_sp.h"
+#include "vad_test_signal.h"
+
+// Scalar build of vad_sp.c, with its external functions renamed
+#define VAD_DISABLE_LANES
+#define WebRtcVad_Downsampling      ScalarVad_Downsampling
+#define WebRtcVad_Downsampling32khz ScalarVad_Downsampling32khz
+#define WebRtcVad_Downsampling48khz ScalarVad_Downsampling48khz
+#define WebRtcVad_FindMinimum       ScalarVad_FindMinimum
+// vad_sp.h is already in, so its prototypes of the renamed functions are not
+void ScalarVad_Downsampling(const int16_t* signal_in, int16_t* signal_out,
+                            int32_t* filter_state, size_t in_length);
+void ScalarVad_Downsampling32khz(const int16_t* signal_in, int16_t* signal_out,
+                                 int32_t* filter_state, size_t in_length);
+void ScalarVad_Downsampling48khz(const int16_t* signal_in, int16_t* signal_out,
+                                 WebRtcSpl_State48khzTo8khz* state, int32_t* scratch);
+int16_t ScalarVad_FindMinimum(VadInstT* handle, int16_t feature_value, int channel);
+#include "vad_sp.c"
+#undef WebRtcVad_Downsampling
+#undef WebRtcVad_Downsampling32khz
+#undef WebRtcVad_Downsampling48khz
+#undef WebRtcVad_FindMinimum
+
+static VadInstT lane_inst;
+static VadInstT scalar_inst;
+
+// Feature value of a channel at a frame: noise, slow ramps that let old minima
+// expire, runs of equal values, drops, and values at or above the empty entry
+// value 10000.
+static int16_t feature_value(struct vad_test_signal *sig, int channel, int frame)
+{
+    int phase = (frame/150 + channel)%5;
+    switch (phase) {
+    case 0:
+        return (int16_t)(1000 + vad_test_noise(sig, 900));
+    case 1:
+        return (int16_t)(200 + (frame%150)*8 + channel);
+    case 2:
+        return (int16_t)(500 + 10*(frame/20%4));
+    case 3:
+        return (int16_t)(frame%37 == 0 ? 50 : 9990 + vad_test_noise(sig, 20));
+    default:
+        return (int16_t)(vad_test_noise(sig, 16000) + 16000);
+    }
+}
+
+static int test_find_minimum(int stream)
+{
+    struct vad_test_signal sig;
+    vad_test_signal_init(&sig, stream);
+    WebRtcVad_InitCore(&lane_inst);
+    WebRtcVad_InitCore(&scalar_inst);
+
+    for (int frame = 0; frame < 5000; frame++) {
+        // As after WebRtcVad_SetNoiseProfile(): all ages equal, so that many
+        // values expire in the same frame
+        if (frame%1000 == 500 + stream) {
+            memset(lane_inst.index_vector, 0, sizeof(lane_inst.index_vector));
+            memset(scalar_inst.index_vector, 0, sizeof(scalar_inst.index_vector));
+        }
+        for (int channel = 0; channel < kNumChannels; channel++) {
+            int16_t value = feature_value(&sig, channel, frame);
+            int16_t lane_min = WebRtcVad_FindMinimum(&lane_inst, value, channel);
+            int16_t scalar_min = ScalarVad_FindMinimum(&scalar_inst, value, channel);
+            if (lane_min != scalar_min ||
+                memcmp(lane_inst.low_value_vector, scalar_inst.low_value_vector,
+                       sizeof(lane_inst.low_value_vector)) != 0 ||
+                memcmp(lane_inst.index_vector, scalar_inst.index_vector,
+                       sizeof(lane_inst.index_vector)) != 0 ||
+                memcmp(lane_inst.mean_value, scalar_inst.mean_value,
+                       sizeof(lane_inst.mean_value)) != 0) {
+                fprintf(stderr, "minimum differs: stream %d, frame %d, channel %d\n",
+                        stream, frame, channel);
+                return -1;
+            }
+        }
+        lane_inst.frame_counter++;
+        scalar_inst.frame_counter++;
+    }
+    return 0;
+}
+
+// WebRtcVad_Downsampling48khz() against the resampler of the signal
+// processing library, with the scratch memory filled with garbage every call
+static int test_downsampling_48khz(int stream)
+{
+    struct vad_test_signal sig;
+    WebRtcSpl_State48khzTo8khz state, expected_state;
+    int32_t scratch[kResampleScratchLength] VAD_SCRATCH_ALIGNED;
+    int32_t tmp_mem[480 + 256];
+    int16_t in[480], out[80], expected[80];
+
+    vad_test_signal_init(&sig, stream);
+    WebRtcSpl_ResetResample48khzTo8khz(&state);
+    WebRtcSpl_ResetResample48khzTo8khz(&expected_state);
+
+    for (int block = 0; block < 3000; block++) {
+        vad_test_signal_frame(&sig, 48000, in, 480);
+        for (int i = 0; i < kResampleScratchLength; i++)
+            scratch[i] = vad_test_noise(&sig, 1 << 30);
+        WebRtcVad_Downsampling48khz(in, out, &state, scratch);
+        WebRtcSpl_Resample48khzTo8khz(in, expected, &expected_state, tmp_mem);
+        if (memcmp(out, expected, sizeof(out)) != 0 ||
+            memcmp(&state, &expected_state, sizeof(state)) != 0) {
+            fprintf(stderr, "48khz downsampling differs: stream %d, block %d\n", stream, block);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// WebRtcVad_Downsampling32khz() against the two WebRtcVad_Downsampling()
+// stages it replaces: 32 -> 16 kHz on states 2 and 3, then 16 -> 8 kHz on
+// states 0 and 1
+static int test_downsampling_32khz(int stream, size_t length)
+{
+    struct vad_test_signal sig;
+    int32_t states[4] = { 0 }, expected_states[4] = { 0 };
+    int16_t in[960], wb[480], out[240], expected[240];
+
+    vad_test_signal_init(&sig, stream);
+    for (int frame = 0; frame < 1000; frame++) {
+        vad_test_signal_frame(&sig, 32000, in, length);
+        WebRtcVad_Downsampling32khz(in, out, states, length);
+        WebRtcVad_Downsampling(in, wb, &expected_states[2], length);
+        WebRtcVad_Downsampling(wb, expected, expected_states, length/2);
+        if (memcmp(out, expected, length/4*sizeof(int16_t)) != 0 ||
+            memcmp(states, expected_states, sizeof(states)) != 0) {
+            fprintf(stderr, "32khz downsampling differs: stream %d, length %zu, frame %d\n",
+                    stream, length, frame);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    for (int i = 0; i < 8; i++) {
+        if (test_find_minimum(i) != 0)
+            return 1;
+    }
+    printf("minimum tracking matches the scalar code\n");
+
+    for (int i = 0; i < 8; i++) {
+        if (test_downsampling_48khz(i) != 0)
+            return 1;
+    }
+    printf("48khz downsampling matches WebRtcSpl_Resample48khzTo8khz()\n");
+
+    static const size_t lengths[] = { 320, 640, 960 };
+    for (int i = 0; i < 8; i++) {
+        for (int l = 0; l < 3; l++) {
+            if (test_downsampling_32khz(i, lengths[l]) != 0)
+                return 1;
+        }
+    }
+    printf("32khz downsampling matches two 2:1 stages\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2023-, Qinglong<sysu.zqlong@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __VAD_TEST_SIGNAL_H
+#define __VAD_TEST_SIGNAL_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Deterministic test signal of one stream. The kind of signal changes every
+// few frames, at another pace per stream, between silence, a low noise floor,
+// voiced harmonics, loud noise and clipped full scale bursts, so that filter
+// states, minimum tracking and GMM adaptation go through all of them.
+struct vad_test_signal {
+    uint32_t seed;
+    int      pace;
+    int      frame;
+    double   phase;
+};
+
+static inline void vad_test_signal_init(struct vad_test_signal *sig, int stream)
+{
+    sig->seed = 0x9e3779b9u*(uint32_t)(stream + 1);
+    sig->pace = 5 + stream%7;
+    sig->frame = 0;
+    sig->phase = 0;
+}
+
+static inline int vad_test_noise(struct vad_test_signal *sig, int amplitude)
+{
+    sig->seed = sig->seed*1664525u + 1013904223u;
+    return (int)((sig->seed >> 16)%(2*amplitude + 1)) - amplitude;
+}
+
+static inline int16_t vad_test_clip(int value)
+{
+    return (int16_t)(value > 32767 ? 32767 : value < -32768 ? -32768 : value);
+}
+
+// Next frame of length samples at sample_rate
+static inline void vad_test_signal_frame(struct vad_test_signal *sig, int sample_rate,
+                                         int16_t *out, size_t length)
+{
+    int kind = (sig->frame/sig->pace + sig->pace)%5;
+    double f0 = 100 + 20*(sig->pace + sig->frame%9);
+    for (size_t i = 0; i < length; i++) {
+        int value = 0;
+        sig->phase += 2*M_PI*f0/sample_rate;
+        switch (kind) {
+        case 1:
+            value = vad_test_noise(sig, 40);
+            break;
+        case 2:
+            for (int h = 1; h < 10; h++)
+                value += (int)(sin(sig->phase*h)*6000/h);
+            value += vad_test_noise(sig, 200);
+            break;
+        case 3:
+            value = vad_test_noise(sig, 20000);
+            break;
+        case 4:
+            value = (sin(sig->phase) >= 0 ? 40000 : -40000) + vad_test_noise(sig, 3000);
+            break;
+        }
+        out[i] = vad_test_clip(value);
+    }
+    sig->frame++;
+}
+
+#endif // __VAD_TEST_SIGNAL_H
@@ -41,6 +41,16 @@ public:
     int Push(const int16_t* samplesIn, size_t lengthIn, int16_t* samplesOut,
              size_t maxLen, size_t &outLen);
 
+    // Size of filter states, see SaveState()
+    size_t StateSize() const;
+
+    // Copy filter states, so that resampling goes on in another instance
+    // reset to the same rates and channels with RestoreState(). The states
+    // are the mode followed by the int32 filter states, in host byte order.
+    int SaveState(void* state, size_t size) const;
+
+    int RestoreState(const void* state, size_t size);
+
 private:
     enum ResamplerMode
     {
@@ -71,6 +81,9 @@ private:
     void* state1_;
     void* state2_;
     void* state3_;
+    size_t state1_size_;
+    size_t state2_size_;
+    size_t state3_size_;
 
     // Storage if needed
     int16_t* in_buffer_;
@@ -85,6 +98,8 @@ private:
     ResamplerMode my_mode_;
     size_t num_channels_;
 
+    void* AllocState(size_t* state_size, size_t size);
+
     // Extra instance for stereo
     Resampler* slave_left_;
     Resampler* slave_right_;
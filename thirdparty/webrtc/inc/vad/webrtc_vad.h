@@ -22,6 +22,16 @@
 
 typedef struct WebRtcVadInst VadInst;
 
+// Noise model of an instance: GMM noise means and stds of the 6 bands x 2
+// Gaussians, and the minimum tracking of each band, 16 smallest recent
+// feature values and their smoothed median.
+typedef struct {
+  int16_t noise_means[12];
+  int16_t noise_stds[12];
+  int16_t low_value_vector[16 * 6];
+  int16_t mean_value[6];
+} WebRtcVadNoiseProfile;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -70,6 +80,80 @@ int WebRtcVad_set_mode(VadInst* handle, int mode);
 int WebRtcVad_Process(VadInst* handle, int fs, const int16_t* audio_frame,
                       size_t frame_length);
 
+// Calculates VAD decisions of one frame for each of |count| instances, all at
+// the same rate and frame length. Same results as calling WebRtcVad_Process()
+// for each instance, but each processing stage runs over all instances before
+// the next one.
+//
+// - handles      [i/o] : VAD Instances.
+// - fs           [i]   : Sampling frequency (Hz): 8000, 16000, 32000 or 48000
+// - audio_frames [i]   : Audio frame buffer of each instance.
+// - frame_length [i]   : Length of each audio frame buffer in number of samples.
+// - count        [i]   : Number of instances.
+// - vads         [o]   : Decision of each instance, 1 - (Active Voice),
+//                        0 - (Non-active Voice)
+//
+// returns              : 0 - (OK), -1 - (Error, no instance processed)
+int WebRtcVad_ProcessBatch(VadInst* const* handles, int fs,
+                           const int16_t* const* audio_frames,
+                           size_t frame_length, int count, int* vads);
+
+// Gets the global log likelihood ratio of speech against noise computed for
+// the last frame, and the threshold of the current mode it is tested against.
+// The margin between them tells how confident the decision is.
+//
+// - handle               [i] : VAD Instance.
+// - log_likelihood_ratio [o] : Spectrum weighted log2 likelihood ratio, 0 if
+//                              the frame energy was too low to be tested.
+// - threshold            [o] : Global threshold for the frame length.
+//
+// returns                    : 0 - (OK), -1 - (NULL pointer or uninitialized)
+int WebRtcVad_GetLikelihood(VadInst* handle, int* log_likelihood_ratio,
+                            int* threshold);
+
+// Gets the noise model of an instance, to warm start other instances with it.
+//
+// - handle  [i] : VAD Instance.
+// - profile [o] : Noise model.
+//
+// returns       : 0 - (OK), -1 - (NULL pointer or uninitialized)
+int WebRtcVad_GetNoiseProfile(VadInst* handle, WebRtcVadNoiseProfile* profile);
+
+// Replaces the noise model of an instance. Ages of the minimum values start
+// over, and the instance is taken as having seen enough frames to use them.
+// Profiles are only meaningful between instances of the same frame length.
+//
+// - handle  [i/o] : VAD Instance.
+// - profile [i]   : Noise model from WebRtcVad_GetNoiseProfile().
+//
+// returns         : 0 - (OK), -1 - (NULL pointer or uninitialized)
+int WebRtcVad_SetNoiseProfile(VadInst* handle,
+                              const WebRtcVadNoiseProfile* profile);
+
+// Size of a saved state, see WebRtcVad_SaveState().
+size_t WebRtcVad_StateSize(void);
+
+// Saves the state of an instance: filter and downsampling states, GMM, minimum
+// tracking and decision hysteresis, so that processing can go on in another
+// instance with WebRtcVad_RestoreState(). The state is a version word followed
+// by the fields packed in host byte order, without padding or work memory.
+//
+// - handle [i] : VAD Instance.
+// - state  [o] : Buffer of |size| bytes.
+// - size   [i] : Buffer size, at least WebRtcVad_StateSize().
+//
+// returns      : 0 - (OK), -1 - (NULL pointer, uninitialized or too small)
+int WebRtcVad_SaveState(VadInst* handle, void* state, size_t size);
+
+// Restores a state from WebRtcVad_SaveState().
+//
+// - handle [i/o] : VAD Instance.
+// - state  [i]   : State of an initialized instance.
+// - size   [i]   : Size of |state|, must be WebRtcVad_StateSize().
+//
+// returns        : 0 - (OK), -1 - (NULL pointer, other size or version)
+int WebRtcVad_RestoreState(VadInst* handle, const void* state, size_t size);
+
 // Checks for valid combinations of |rate| and |frame_length|. We support 10,
 // 20 and 30 ms frames and the rates 8000, 16000 and 32000 Hz.
 //
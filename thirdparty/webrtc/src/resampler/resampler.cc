@@ -25,6 +25,9 @@ Resampler::Resampler()
     : state1_(nullptr),
       state2_(nullptr),
       state3_(nullptr),
+      state1_size_(0),
+      state2_size_(0),
+      state3_size_(0),
       in_buffer_(nullptr),
       out_buffer_(nullptr),
       in_buffer_size_(0),
@@ -102,16 +105,19 @@ int Resampler::Reset(int inFreq, int outFreq, size_t num_channels)
     {
         free(state1_);
         state1_ = NULL;
+        state1_size_ = 0;
     }
     if (state2_)
     {
         free(state2_);
         state2_ = NULL;
+        state2_size_ = 0;
     }
     if (state3_)
     {
         free(state3_);
         state3_ = NULL;
+        state3_size_ = 0;
     }
     if (in_buffer_)
     {
@@ -255,143 +261,143 @@ int Resampler::Reset(int inFreq, int outFreq, size_t num_channels)
             // No state needed;
             break;
         case kResamplerMode1To2:
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode1To3:
-            state1_ = malloc(sizeof(WebRtcSpl_State16khzTo48khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State16khzTo48khz));
             WebRtcSpl_ResetResample16khzTo48khz((WebRtcSpl_State16khzTo48khz *)state1_);
             break;
         case kResamplerMode1To4:
             // 1:2
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             // 2:4
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode1To6:
             // 1:2
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             // 2:6
-            state2_ = malloc(sizeof(WebRtcSpl_State16khzTo48khz));
+            state2_ = AllocState(&state2_size_, sizeof(WebRtcSpl_State16khzTo48khz));
             WebRtcSpl_ResetResample16khzTo48khz((WebRtcSpl_State16khzTo48khz *)state2_);
             break;
         case kResamplerMode1To12:
             // 1:2
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             // 2:4
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
             // 4:12
-            state3_ = malloc(sizeof(WebRtcSpl_State16khzTo48khz));
+            state3_ = AllocState(&state3_size_, sizeof(WebRtcSpl_State16khzTo48khz));
             WebRtcSpl_ResetResample16khzTo48khz(
                 (WebRtcSpl_State16khzTo48khz*) state3_);
             break;
         case kResamplerMode2To3:
             // 2:6
-            state1_ = malloc(sizeof(WebRtcSpl_State16khzTo48khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State16khzTo48khz));
             WebRtcSpl_ResetResample16khzTo48khz((WebRtcSpl_State16khzTo48khz *)state1_);
             // 6:3
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode2To11:
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
 
-            state2_ = malloc(sizeof(WebRtcSpl_State8khzTo22khz));
+            state2_ = AllocState(&state2_size_, sizeof(WebRtcSpl_State8khzTo22khz));
             WebRtcSpl_ResetResample8khzTo22khz((WebRtcSpl_State8khzTo22khz *)state2_);
             break;
         case kResamplerMode4To11:
-            state1_ = malloc(sizeof(WebRtcSpl_State8khzTo22khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State8khzTo22khz));
             WebRtcSpl_ResetResample8khzTo22khz((WebRtcSpl_State8khzTo22khz *)state1_);
             break;
         case kResamplerMode8To11:
-            state1_ = malloc(sizeof(WebRtcSpl_State16khzTo22khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State16khzTo22khz));
             WebRtcSpl_ResetResample16khzTo22khz((WebRtcSpl_State16khzTo22khz *)state1_);
             break;
         case kResamplerMode11To16:
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
 
-            state2_ = malloc(sizeof(WebRtcSpl_State22khzTo16khz));
+            state2_ = AllocState(&state2_size_, sizeof(WebRtcSpl_State22khzTo16khz));
             WebRtcSpl_ResetResample22khzTo16khz((WebRtcSpl_State22khzTo16khz *)state2_);
             break;
         case kResamplerMode11To32:
             // 11 -> 22
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
 
             // 22 -> 16
-            state2_ = malloc(sizeof(WebRtcSpl_State22khzTo16khz));
+            state2_ = AllocState(&state2_size_, sizeof(WebRtcSpl_State22khzTo16khz));
             WebRtcSpl_ResetResample22khzTo16khz((WebRtcSpl_State22khzTo16khz *)state2_);
 
             // 16 -> 32
-            state3_ = malloc(8 * sizeof(int32_t));
+            state3_ = AllocState(&state3_size_, 8 * sizeof(int32_t));
             memset(state3_, 0, 8 * sizeof(int32_t));
 
             break;
         case kResamplerMode2To1:
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode3To1:
-            state1_ = malloc(sizeof(WebRtcSpl_State48khzTo16khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State48khzTo16khz));
             WebRtcSpl_ResetResample48khzTo16khz((WebRtcSpl_State48khzTo16khz *)state1_);
             break;
         case kResamplerMode4To1:
             // 4:2
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             // 2:1
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode6To1:
             // 6:2
-            state1_ = malloc(sizeof(WebRtcSpl_State48khzTo16khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State48khzTo16khz));
             WebRtcSpl_ResetResample48khzTo16khz((WebRtcSpl_State48khzTo16khz *)state1_);
             // 2:1
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode12To1:
             // 12:4
-            state1_ = malloc(sizeof(WebRtcSpl_State48khzTo16khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State48khzTo16khz));
             WebRtcSpl_ResetResample48khzTo16khz(
                 (WebRtcSpl_State48khzTo16khz*) state1_);
             // 4:2
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
             // 2:1
-            state3_ = malloc(8 * sizeof(int32_t));
+            state3_ = AllocState(&state3_size_, 8 * sizeof(int32_t));
             memset(state3_, 0, 8 * sizeof(int32_t));
             break;
         case kResamplerMode3To2:
             // 3:6
-            state1_ = malloc(8 * sizeof(int32_t));
+            state1_ = AllocState(&state1_size_, 8 * sizeof(int32_t));
             memset(state1_, 0, 8 * sizeof(int32_t));
             // 6:2
-            state2_ = malloc(sizeof(WebRtcSpl_State48khzTo16khz));
+            state2_ = AllocState(&state2_size_, sizeof(WebRtcSpl_State48khzTo16khz));
             WebRtcSpl_ResetResample48khzTo16khz((WebRtcSpl_State48khzTo16khz *)state2_);
             break;
         case kResamplerMode11To2:
-            state1_ = malloc(sizeof(WebRtcSpl_State22khzTo8khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State22khzTo8khz));
             WebRtcSpl_ResetResample22khzTo8khz((WebRtcSpl_State22khzTo8khz *)state1_);
 
-            state2_ = malloc(8 * sizeof(int32_t));
+            state2_ = AllocState(&state2_size_, 8 * sizeof(int32_t));
             memset(state2_, 0, 8 * sizeof(int32_t));
 
             break;
         case kResamplerMode11To4:
-            state1_ = malloc(sizeof(WebRtcSpl_State22khzTo8khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State22khzTo8khz));
             WebRtcSpl_ResetResample22khzTo8khz((WebRtcSpl_State22khzTo8khz *)state1_);
             break;
         case kResamplerMode11To8:
-            state1_ = malloc(sizeof(WebRtcSpl_State22khzTo16khz));
+            state1_ = AllocState(&state1_size_, sizeof(WebRtcSpl_State22khzTo16khz));
             WebRtcSpl_ResetResample22khzTo16khz((WebRtcSpl_State22khzTo16khz *)state1_);
             break;
 
@@ -400,6 +406,80 @@ int Resampler::Reset(int inFreq, int outFreq, size_t num_channels)
     return 0;
 }
 
+void* Resampler::AllocState(size_t* state_size, size_t size)
+{
+    *state_size = size;
+    return malloc(size);
+}
+
+size_t Resampler::StateSize() const
+{
+    size_t size = sizeof(int32_t) + state1_size_ + state2_size_ + state3_size_;
+    if (slave_left_)
+    {
+        size += slave_left_->StateSize() + slave_right_->StateSize();
+    }
+    return size;
+}
+
+int Resampler::SaveState(void* state, size_t size) const
+{
+    if (state == NULL || size < StateSize())
+    {
+        return -1;
+    }
+    char* dst = (char*)state;
+    int32_t mode = my_mode_;
+    memcpy(dst, &mode, sizeof(mode));
+    dst += sizeof(mode);
+    memcpy(dst, state1_, state1_size_);
+    dst += state1_size_;
+    memcpy(dst, state2_, state2_size_);
+    dst += state2_size_;
+    memcpy(dst, state3_, state3_size_);
+    dst += state3_size_;
+    if (slave_left_)
+    {
+        size_t slave_size = slave_left_->StateSize();
+        slave_left_->SaveState(dst, slave_size);
+        slave_right_->SaveState(dst + slave_size, slave_right_->StateSize());
+    }
+    return 0;
+}
+
+int Resampler::RestoreState(const void* state, size_t size)
+{
+    const char* src = (const char*)state;
+    int32_t mode;
+    if (state == NULL || size != StateSize())
+    {
+        return -1;
+    }
+    memcpy(&mode, src, sizeof(mode));
+    if (mode != my_mode_)
+    {
+        return -1;
+    }
+    if (slave_left_)
+    {
+        size_t offset = sizeof(mode) + state1_size_ + state2_size_ + state3_size_;
+        size_t slave_size = slave_left_->StateSize();
+        if (slave_left_->RestoreState(src + offset, slave_size) != 0 ||
+            slave_right_->RestoreState(src + offset + slave_size,
+                                       slave_right_->StateSize()) != 0)
+        {
+            return -1;
+        }
+    }
+    src += sizeof(mode);
+    memcpy(state1_, src, state1_size_);
+    src += state1_size_;
+    memcpy(state2_, src, state2_size_);
+    src += state2_size_;
+    memcpy(state3_, src, state3_size_);
+    return 0;
+}
+
 // Synchronous resampling, all output samples are written to samplesOut
 int Resampler::Push(const int16_t * samplesIn, size_t lengthIn,
                     int16_t* samplesOut, size_t maxLen, size_t &outLen)
@@ -10,6 +10,8 @@
 
 #include "vad_core.h"
 
+#include <string.h>
+
 #include "signal_processing/signal_processing_library.h"
 #include "vad_filterbank.h"
 #include "vad_gmm.h"
@@ -27,8 +29,6 @@ static const int16_t kMinimumDifference[kNumChannels] = {
 // Upper limit of mean value for speech model, Q7
 static const int16_t kMaximumSpeech[kNumChannels] = {
     11392, 11392, 11520, 11520, 11520, 11520 };
-// Minimum value for mean value
-static const int16_t kMinimumMean[kNumGaussians] = { 640, 768 };
 // Upper limit of mean value for noise model, Q7
 static const int16_t kMaximumNoise[kNumChannels] = {
     9216, 9088, 8960, 8832, 8704, 8576 };
@@ -110,6 +110,362 @@ static int32_t WeightedAverage(int16_t* data, int16_t offset,
   return weighted_average;
 }
 
+// Limits of the noise means, (k + 5) << 7 and (72 + k - channel) << 7 for
+// Gaussian |k| of |channel|, Q7. The lower limit is also the minimum of the
+// speech means.
+static const int16_t kMeanLow[kTableSize] VAD_TABLE_ALIGNED = {
+    640, 640, 640, 640, 640, 640, 768, 768, 768, 768, 768, 768 };
+static const int16_t kNoiseMeanHigh[kTableSize] VAD_TABLE_ALIGNED = {
+    9216, 9088, 8960, 8832, 8704, 8576, 9344, 9216, 9088, 8960, 8832, 8704 };
+// Upper limit of the speech means, 640 above kMaximumSpeech[] of the previous
+// channel (12800 for the first one), Q7.
+static const int16_t kSpeechMeanHigh[kTableSize] VAD_TABLE_ALIGNED = {
+    13440, 12032, 12032, 12160, 12160, 12160,
+    13440, 12032, 12032, 12160, 12160, 12160 };
+
+// The Gaussians are evaluated and updated four at a time, with GCC vector
+// extensions. Values are kept in int32 lanes and wrapped to 16 bits wherever
+// the scalar code stores to an int16_t, and the divisions are done in doubles,
+// which hold both operands and truncate the quotient exactly. Hence the
+// results are bit exact. Only targets with vector double division (SSE2,
+// AArch64) take this path, ARMv7 NEON would divide the lanes one by one.
+// VAD_DISABLE_LANES keeps the scalar code, as a reference for tests.
+#if defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 9) && \
+    (defined(__SSE2__) || defined(__aarch64__)) && !defined(VAD_DISABLE_LANES)
+#define VAD_GMM_LANES
+
+enum { kGmmLanes = 4 };
+
+typedef int16_t GmmLanes16 __attribute__((vector_size(8)));
+typedef int32_t GmmLanes __attribute__((vector_size(16)));
+typedef double GmmLanesF64 __attribute__((vector_size(32)));
+
+#define VAD_GMM_INLINE static __inline __attribute__((always_inline))
+
+// Wraps each lane to int16_t, as a store to an int16_t does.
+#define WRAP16(x) (((x) << 16) >> 16)
+
+#define LOAD_LANES(table, gaussian) \
+  __builtin_convertvector(*(const GmmLanes16*)&(table)[gaussian], GmmLanes)
+#define STORE_LANES(table, gaussian, x) \
+  (*(GmmLanes16*)&(table)[gaussian] = __builtin_convertvector(x, GmmLanes16))
+
+// Constants of WebRtcVad_GaussianProbability().
+static const int32_t kCompVar = 22005;
+static const int16_t kLog2Exp = 5909;  // log2(exp(1)) in Q12.
+
+// (int16_t) WebRtcSpl_DivW32W16() of |num| by |den|, where the sign of a
+// non-positive |num| is applied after the division as GmmProbability() does,
+// i.e., -1 for a positive and 1 for a non-positive |num| if |den| is 0.
+VAD_GMM_INLINE GmmLanes DivideLanes(GmmLanes num, GmmLanes den) {
+  const GmmLanes zero = den == 0;
+  GmmLanesF64 quotient = __builtin_convertvector(num, GmmLanesF64) /
+      __builtin_convertvector(den - zero, GmmLanesF64);
+  GmmLanes result = __builtin_convertvector(quotient, GmmLanes);
+
+  return WRAP16((result & ~zero) | (((num > 0) | 1) & zero));
+}
+
+VAD_GMM_INLINE GmmLanes MaxLanes(GmmLanes a, GmmLanes b) {
+  const GmmLanes less = a < b;
+  return (a & ~less) | (b & less);
+}
+
+VAD_GMM_INLINE GmmLanes MinLanes(GmmLanes a, GmmLanes b) {
+  const GmmLanes greater = a > b;
+  return (a & ~greater) | (b & greater);
+}
+
+// WebRtcVad_GaussianProbability() of each lane.
+VAD_GMM_INLINE void GaussianProbabilityLanes(GmmLanes input,
+                                             GmmLanes mean,
+                                             GmmLanes std,
+                                             GmmLanes* probability,
+                                             GmmLanes* delta) {
+  GmmLanes tmp16, inv_std, inv_std2, exp_value;
+  GmmLanes tmp32;
+
+  inv_std = DivideLanes(131072 + (std >> 1), std);  // Q10
+  tmp16 = inv_std >> 2;
+  inv_std2 = WRAP16((tmp16 * tmp16) >> 2);  // Q14
+
+  tmp16 = WRAP16(WRAP16(input << 3) - mean);  // Q7
+  *delta = WRAP16((inv_std2 * tmp16) >> 10);  // Q11
+  tmp32 = (*delta * tmp16) >> 9;  // Q10
+
+  tmp16 = WRAP16(-WRAP16((kLog2Exp * tmp32) >> 12));
+  exp_value = 0x0400 | (tmp16 & 0x03FF);
+  tmp16 = (WRAP16(tmp16 ^ 0xFFFF) >> 10) + 1;
+  exp_value >>= tmp16;
+  // Zero probability where the exponent is too large.
+  exp_value &= tmp32 < kCompVar;
+
+  *probability = inv_std * exp_value;  // Q20
+}
+#endif  // VAD_GMM_LANES
+
+// Calculates the weighted probabilities of |features| for all Gaussians of
+// the noise and speech models.
+//
+// - self               [i]   : Pointer to VAD instance
+// - features           [i]   : Feature of the channel of each Gaussian
+// - noise_probability  [o]   : Noise probabilities, Q27
+// - speech_probability [o]   : Speech probabilities, Q27
+// - deltaN             [o]   : |delta| of the noise Gaussians, Q11
+// - deltaS             [o]   : |delta| of the speech Gaussians, Q11
+static void GaussianProbabilities(const VadInstT* self,
+                                  const int16_t* features,
+                                  int32_t* noise_probability,
+                                  int32_t* speech_probability,
+                                  int16_t* deltaN,
+                                  int16_t* deltaS) {
+  int gaussian;
+
+#ifdef VAD_GMM_LANES
+  for (gaussian = 0; gaussian < kTableSize; gaussian += kGmmLanes) {
+    GmmLanes input = LOAD_LANES(features, gaussian);
+    GmmLanes probability, delta;
+
+    GaussianProbabilityLanes(input, LOAD_LANES(self->noise_means, gaussian),
+                             LOAD_LANES(self->noise_stds, gaussian),
+                             &probability, &delta);
+    probability *= LOAD_LANES(kNoiseDataWeights, gaussian);
+    memcpy(&noise_probability[gaussian], &probability, sizeof(probability));
+    STORE_LANES(deltaN, gaussian, delta);
+
+    GaussianProbabilityLanes(input, LOAD_LANES(self->speech_means, gaussian),
+                             LOAD_LANES(self->speech_stds, gaussian),
+                             &probability, &delta);
+    probability *= LOAD_LANES(kSpeechDataWeights, gaussian);
+    memcpy(&speech_probability[gaussian], &probability, sizeof(probability));
+    STORE_LANES(deltaS, gaussian, delta);
+  }
+#else
+  for (gaussian = 0; gaussian < kTableSize; gaussian++) {
+    // Value given in Q27 = Q7 * Q20.
+    noise_probability[gaussian] = kNoiseDataWeights[gaussian] *
+        WebRtcVad_GaussianProbability(features[gaussian],
+                                      self->noise_means[gaussian],
+                                      self->noise_stds[gaussian],
+                                      &deltaN[gaussian]);
+    speech_probability[gaussian] = kSpeechDataWeights[gaussian] *
+        WebRtcVad_GaussianProbability(features[gaussian],
+                                      self->speech_means[gaussian],
+                                      self->speech_stds[gaussian],
+                                      &deltaS[gaussian]);
+  }
+#endif
+}
+
+// Updates the means and standard deviations of all Gaussians, the speech
+// model if |vadflag| is set and the noise model otherwise. All arrays hold
+// one value per Gaussian.
+//
+// - self               [i/o] : Pointer to VAD instance
+// - features           [i]   : Feature of the channel, Q4
+// - feature_minimum    [i]   : Minimum of the feature in past, Q4
+// - noise_global_mean  [i]   : Weighted noise mean of the channel, Q8
+// - ngprvec            [i]   : Conditional noise probabilities, Q14
+// - sgprvec            [i]   : Conditional speech probabilities, Q14
+// - deltaN             [i]   : |delta| of the noise Gaussians, Q11
+// - deltaS             [i]   : |delta| of the speech Gaussians, Q11
+// - vadflag            [i]   : VAD decision of the frame
+static void UpdateGaussians(VadInstT* self,
+                            const int16_t* features,
+                            const int16_t* feature_minimum,
+                            const int16_t* noise_global_mean,
+                            const int16_t* ngprvec,
+                            const int16_t* sgprvec,
+                            const int16_t* deltaN,
+                            const int16_t* deltaS,
+                            int16_t vadflag) {
+  int gaussian;
+
+#ifdef VAD_GMM_LANES
+  const GmmLanes min_std = { kMinStd, kMinStd, kMinStd, kMinStd };
+
+  for (gaussian = 0; gaussian < kTableSize; gaussian += kGmmLanes) {
+    GmmLanes nmk = LOAD_LANES(self->noise_means, gaussian);
+    GmmLanes nmk2, nmk3, smk, smk2, nsk, ssk;
+    GmmLanes delt, ndelt, tmp16, tmp1_s32, tmp2_s32;
+    GmmLanes features_lanes = LOAD_LANES(features, gaussian);
+
+    nmk2 = nmk;
+    if (!vadflag) {
+      delt = WRAP16((LOAD_LANES(ngprvec, gaussian) *
+                     LOAD_LANES(deltaN, gaussian)) >> 11);
+      nmk2 = WRAP16(nmk + WRAP16((delt * kNoiseUpdateConst) >> 22));
+    }
+
+    ndelt = WRAP16((LOAD_LANES(feature_minimum, gaussian) << 4) -
+                   LOAD_LANES(noise_global_mean, gaussian));
+    nmk3 = WRAP16(nmk2 + WRAP16((ndelt * kBackEta) >> 9));
+    tmp16 = LOAD_LANES(kMeanLow, gaussian);
+    nmk3 = MaxLanes(nmk3, tmp16);
+    tmp16 = LOAD_LANES(kNoiseMeanHigh, gaussian);
+    nmk3 = MinLanes(nmk3, tmp16);
+    STORE_LANES(self->noise_means, gaussian, nmk3);
+
+    if (vadflag) {
+      GmmLanes sgprvec_lanes = LOAD_LANES(sgprvec, gaussian);
+      GmmLanes deltaS_lanes = LOAD_LANES(deltaS, gaussian);
+
+      smk = LOAD_LANES(self->speech_means, gaussian);
+      delt = WRAP16((sgprvec_lanes * deltaS_lanes) >> 11);
+      tmp16 = WRAP16((delt * kSpeechUpdateConst) >> 21);
+      smk2 = WRAP16(smk + ((tmp16 + 1) >> 1));
+      tmp16 = LOAD_LANES(kMeanLow, gaussian);
+      smk2 = MaxLanes(smk2, tmp16);
+      tmp16 = LOAD_LANES(kSpeechMeanHigh, gaussian);
+      smk2 = MinLanes(smk2, tmp16);
+      STORE_LANES(self->speech_means, gaussian, smk2);
+
+      tmp16 = WRAP16(features_lanes - WRAP16((smk + 4) >> 3));
+      tmp1_s32 = (deltaS_lanes * tmp16) >> 3;
+      tmp2_s32 = ((sgprvec_lanes >> 2) * (tmp1_s32 - 4096)) >> 4;
+
+      ssk = LOAD_LANES(self->speech_stds, gaussian);
+      tmp16 = WRAP16(DivideLanes(tmp2_s32, WRAP16(ssk * 10)) + 128);
+      ssk = WRAP16(ssk + (tmp16 >> 8));
+      ssk = MaxLanes(ssk, min_std);
+      STORE_LANES(self->speech_stds, gaussian, ssk);
+    } else {
+      tmp16 = WRAP16(features_lanes - (nmk >> 3));
+      tmp1_s32 = ((LOAD_LANES(deltaN, gaussian) * tmp16) >> 3) - 4096;
+      tmp2_s32 = ((LOAD_LANES(ngprvec, gaussian) + 2) >> 2) * tmp1_s32;
+      tmp1_s32 = tmp2_s32 >> 14;
+
+      nsk = LOAD_LANES(self->noise_stds, gaussian);
+      tmp16 = WRAP16(DivideLanes(tmp1_s32, nsk) + 32);
+      nsk = WRAP16(nsk + (tmp16 >> 6));
+      nsk = MaxLanes(nsk, min_std);
+      STORE_LANES(self->noise_stds, gaussian, nsk);
+    }
+  }
+#else
+  int16_t nmk, nmk2, nmk3, smk, smk2, nsk, ssk;
+  int16_t delt, ndelt, tmp_s16;
+  int32_t tmp1_s32, tmp2_s32;
+
+  for (gaussian = 0; gaussian < kTableSize; gaussian++) {
+    nmk = self->noise_means[gaussian];
+    smk = self->speech_means[gaussian];
+    nsk = self->noise_stds[gaussian];
+    ssk = self->speech_stds[gaussian];
+
+    // Update noise mean vector if the frame consists of noise only.
+    nmk2 = nmk;
+    if (!vadflag) {
+      // deltaN = (x-mu)/sigma^2
+      // ngprvec[k] = |noise_probability[k]| /
+      //   (|noise_probability[0]| + |noise_probability[1]|)
+
+      // (Q14 * Q11 >> 11) = Q14.
+      delt = (int16_t)((ngprvec[gaussian] * deltaN[gaussian]) >> 11);
+      // Q7 + (Q14 * Q15 >> 22) = Q7.
+      nmk2 = nmk + (int16_t)((delt * kNoiseUpdateConst) >> 22);
+    }
+
+    // Long term correction of the noise mean.
+    // Q8 - Q8 = Q8.
+    ndelt = (feature_minimum[gaussian] << 4) - noise_global_mean[gaussian];
+    // Q7 + (Q8 * Q8) >> 9 = Q7.
+    nmk3 = nmk2 + (int16_t)((ndelt * kBackEta) >> 9);
+
+    // Control that the noise mean does not drift to much.
+    if (nmk3 < kMeanLow[gaussian]) {
+      nmk3 = kMeanLow[gaussian];
+    }
+    if (nmk3 > kNoiseMeanHigh[gaussian]) {
+      nmk3 = kNoiseMeanHigh[gaussian];
+    }
+    self->noise_means[gaussian] = nmk3;
+
+    if (vadflag) {
+      // Update speech mean vector:
+      // |deltaS| = (x-mu)/sigma^2
+      // sgprvec[k] = |speech_probability[k]| /
+      //   (|speech_probability[0]| + |speech_probability[1]|)
+
+      // (Q14 * Q11) >> 11 = Q14.
+      delt = (int16_t)((sgprvec[gaussian] * deltaS[gaussian]) >> 11);
+      // Q14 * Q15 >> 21 = Q8.
+      tmp_s16 = (int16_t)((delt * kSpeechUpdateConst) >> 21);
+      // Q7 + (Q8 >> 1) = Q7. With rounding.
+      smk2 = smk + ((tmp_s16 + 1) >> 1);
+
+      // Control that the speech mean does not drift to much.
+      if (smk2 < kMeanLow[gaussian]) {
+        smk2 = kMeanLow[gaussian];
+      }
+      if (smk2 > kSpeechMeanHigh[gaussian]) {
+        smk2 = kSpeechMeanHigh[gaussian];
+      }
+      self->speech_means[gaussian] = smk2;  // Q7.
+
+      // (Q7 >> 3) = Q4. With rounding.
+      tmp_s16 = ((smk + 4) >> 3);
+
+      tmp_s16 = features[gaussian] - tmp_s16;  // Q4
+      // (Q11 * Q4 >> 3) = Q12.
+      tmp1_s32 = (deltaS[gaussian] * tmp_s16) >> 3;
+      tmp2_s32 = tmp1_s32 - 4096;
+      tmp_s16 = sgprvec[gaussian] >> 2;
+      // (Q14 >> 2) * Q12 = Q24.
+      tmp1_s32 = tmp_s16 * tmp2_s32;
+
+      tmp2_s32 = tmp1_s32 >> 4;  // Q20
+
+      // 0.1 * Q20 / Q7 = Q13.
+      if (tmp2_s32 > 0) {
+        tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(tmp2_s32, ssk * 10);
+      } else {
+        tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(-tmp2_s32, ssk * 10);
+        tmp_s16 = -tmp_s16;
+      }
+      // Divide by 4 giving an update factor of 0.025 (= 0.1 / 4).
+      // Note that division by 4 equals shift by 2, hence,
+      // (Q13 >> 8) = (Q13 >> 6) / 4 = Q7.
+      tmp_s16 += 128;  // Rounding.
+      ssk += (tmp_s16 >> 8);
+      if (ssk < kMinStd) {
+        ssk = kMinStd;
+      }
+      self->speech_stds[gaussian] = ssk;
+    } else {
+      // Update GMM variance vectors.
+      // deltaN * (features[channel] - nmk) - 1
+      // Q4 - (Q7 >> 3) = Q4.
+      tmp_s16 = features[gaussian] - (nmk >> 3);
+      // (Q11 * Q4 >> 3) = Q12.
+      tmp1_s32 = (deltaN[gaussian] * tmp_s16) >> 3;
+      tmp1_s32 -= 4096;
+
+      // (Q14 >> 2) * Q12 = Q24.
+      tmp_s16 = (ngprvec[gaussian] + 2) >> 2;
+      tmp2_s32 = tmp_s16 * tmp1_s32;
+      // Q20  * approx 0.001 (2^-10=0.0009766), hence,
+      // (Q24 >> 14) = (Q24 >> 4) / 2^10 = Q20.
+      tmp1_s32 = tmp2_s32 >> 14;
+
+      // Q20 / Q7 = Q13.
+      if (tmp1_s32 > 0) {
+        tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(tmp1_s32, nsk);
+      } else {
+        tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(-tmp1_s32, nsk);
+        tmp_s16 = -tmp_s16;
+      }
+      tmp_s16 += 32;  // Rounding
+      nsk += tmp_s16 >> 6;  // Q13 >> 6 = Q7.
+      if (nsk < kMinStd) {
+        nsk = kMinStd;
+      }
+      self->noise_stds[gaussian] = nsk;
+    }
+  }
+#endif
+}
+
 // Calculates the probabilities for both speech and background noise using
 // Gaussian Mixture Models (GMM). A hypothesis-test is performed to decide which
 // type of signal is most probable.
@@ -123,26 +479,28 @@ static int32_t WeightedAverage(int16_t* data, int16_t offset,
 // - returns              : the VAD decision (0 - noise, 1 - speech).
 static int16_t GmmProbability(VadInstT* self, int16_t* features,
                               int16_t total_power, size_t frame_length) {
-  int channel, k;
-  int16_t feature_minimum;
+  int channel, gaussian;
   int16_t h0, h1;
   int16_t log_likelihood_ratio;
   int16_t vadflag = 0;
   int16_t shifts_h0, shifts_h1;
   int16_t tmp_s16, tmp1_s16, tmp2_s16;
   int16_t diff;
-  int gaussian;
-  int16_t nmk, nmk2, nmk3, smk, smk2, nsk, ssk;
-  int16_t delt, ndelt;
-  int16_t maxspe, maxmu;
-  int16_t deltaN[kTableSize], deltaS[kTableSize];
-  int16_t ngprvec[kTableSize] = { 0 };  // Conditional probability = 0.
-  int16_t sgprvec[kTableSize] = { 0 };  // Conditional probability = 0.
+  int16_t maxspe;
+  // Per Gaussian copies of the per channel values, for UpdateGaussians().
+  int16_t gaussian_features[kTableSize] VAD_TABLE_ALIGNED;
+  int16_t feature_minimum[kTableSize] VAD_TABLE_ALIGNED;
+  int16_t noise_mean_q8[kTableSize] VAD_TABLE_ALIGNED;
+  int16_t deltaN[kTableSize] VAD_TABLE_ALIGNED;
+  int16_t deltaS[kTableSize] VAD_TABLE_ALIGNED;
+  // Conditional probability = 0.
+  int16_t ngprvec[kTableSize] VAD_TABLE_ALIGNED = { 0 };
+  int16_t sgprvec[kTableSize] VAD_TABLE_ALIGNED = { 0 };
   int32_t h0_test, h1_test;
-  int32_t tmp1_s32, tmp2_s32;
+  int32_t tmp1_s32;
   int32_t sum_log_likelihood_ratios = 0;
   int32_t noise_global_mean, speech_global_mean;
-  int32_t noise_probability[kNumGaussians], speech_probability[kNumGaussians];
+  int32_t noise_probability[kTableSize], speech_probability[kTableSize];
   int16_t overhead1, overhead2, individualTest, totalTest;
 
   // Set various thresholds based on frame lengths (80, 160 or 240 samples).
@@ -175,32 +533,22 @@ static int16_t GmmProbability(VadInstT* self, int16_t* features,
     //
     // We combine a global LRT with local tests, for each frequency sub-band,
     // here defined as |channel|.
+    for (gaussian = 0; gaussian < kTableSize; gaussian++) {
+      gaussian_features[gaussian] = features[gaussian % kNumChannels];
+    }
+
+    // For each channel we model the probability with a GMM consisting of
+    // |kNumGaussians|, with different means and standard deviations depending
+    // on H0 or H1. Probabilities of the frame being noise (H0) and speech (H1)
+    // are given in Q27 = Q7 * Q20.
+    GaussianProbabilities(self, gaussian_features, noise_probability,
+                          speech_probability, deltaN, deltaS);
+
     for (channel = 0; channel < kNumChannels; channel++) {
-      // For each channel we model the probability with a GMM consisting of
-      // |kNumGaussians|, with different means and standard deviations depending
-      // on H0 or H1.
-      h0_test = 0;
-      h1_test = 0;
-      for (k = 0; k < kNumGaussians; k++) {
-        gaussian = channel + k * kNumChannels;
-        // Probability under H0, that is, probability of frame being noise.
-        // Value given in Q27 = Q7 * Q20.
-        tmp1_s32 = WebRtcVad_GaussianProbability(features[channel],
-                                                 self->noise_means[gaussian],
-                                                 self->noise_stds[gaussian],
-                                                 &deltaN[gaussian]);
-        noise_probability[k] = kNoiseDataWeights[gaussian] * tmp1_s32;
-        h0_test += noise_probability[k];  // Q27
-
-        // Probability under H1, that is, probability of frame being speech.
-        // Value given in Q27 = Q7 * Q20.
-        tmp1_s32 = WebRtcVad_GaussianProbability(features[channel],
-                                                 self->speech_means[gaussian],
-                                                 self->speech_stds[gaussian],
-                                                 &deltaS[gaussian]);
-        speech_probability[k] = kSpeechDataWeights[gaussian] * tmp1_s32;
-        h1_test += speech_probability[k];  // Q27
-      }
+      h0_test = noise_probability[channel] +
+          noise_probability[channel + kNumChannels];  // Q27
+      h1_test = speech_probability[channel] +
+          speech_probability[channel + kNumChannels];  // Q27
 
       // Calculate the log likelihood ratio: log2(Pr{X|H1} / Pr{X|H1}).
       // Approximation:
@@ -242,7 +590,7 @@ static int16_t GmmProbability(VadInstT* self, int16_t* features,
       if (h0 > 0) {
         // High probability of noise. Assign conditional probabilities for each
         // Gaussian in the GMM.
-        tmp1_s32 = (noise_probability[0] & 0xFFFFF000) << 2;  // Q29
+        tmp1_s32 = (noise_probability[channel] & 0xFFFFF000) << 2;  // Q29
         ngprvec[channel] = (int16_t) WebRtcSpl_DivW32W16(tmp1_s32, h0);  // Q14
         ngprvec[channel + kNumChannels] = 16384 - ngprvec[channel];
       } else {
@@ -256,7 +604,7 @@ static int16_t GmmProbability(VadInstT* self, int16_t* features,
       if (h1 > 0) {
         // High probability of speech. Assign conditional probabilities for each
         // Gaussian in the GMM. Otherwise use the initialized values, i.e., 0.
-        tmp1_s32 = (speech_probability[0] & 0xFFFFF000) << 2;  // Q29
+        tmp1_s32 = (speech_probability[channel] & 0xFFFFF000) << 2;  // Q29
         sgprvec[channel] = (int16_t) WebRtcSpl_DivW32W16(tmp1_s32, h1);  // Q14
         sgprvec[channel + kNumChannels] = 16384 - sgprvec[channel];
       }
@@ -264,141 +612,27 @@ static int16_t GmmProbability(VadInstT* self, int16_t* features,
 
     // Make a global VAD decision.
     vadflag |= (sum_log_likelihood_ratios >= totalTest);
+    self->log_likelihood_ratio = sum_log_likelihood_ratios;
 
     // Update the model parameters.
-    maxspe = 12800;
     for (channel = 0; channel < kNumChannels; channel++) {
-
       // Get minimum value in past which is used for long term correction in Q4.
-      feature_minimum = WebRtcVad_FindMinimum(self, features[channel], channel);
+      tmp_s16 = WebRtcVad_FindMinimum(self, features[channel], channel);
+      feature_minimum[channel] = tmp_s16;
+      feature_minimum[channel + kNumChannels] = tmp_s16;
 
       // Compute the "global" mean, that is the sum of the two means weighted.
       noise_global_mean = WeightedAverage(&self->noise_means[channel], 0,
                                           &kNoiseDataWeights[channel]);
-      tmp1_s16 = (int16_t) (noise_global_mean >> 6);  // Q8
-
-      for (k = 0; k < kNumGaussians; k++) {
-        gaussian = channel + k * kNumChannels;
-
-        nmk = self->noise_means[gaussian];
-        smk = self->speech_means[gaussian];
-        nsk = self->noise_stds[gaussian];
-        ssk = self->speech_stds[gaussian];
-
-        // Update noise mean vector if the frame consists of noise only.
-        nmk2 = nmk;
-        if (!vadflag) {
-          // deltaN = (x-mu)/sigma^2
-          // ngprvec[k] = |noise_probability[k]| /
-          //   (|noise_probability[0]| + |noise_probability[1]|)
-
-          // (Q14 * Q11 >> 11) = Q14.
-          delt = (int16_t)((ngprvec[gaussian] * deltaN[gaussian]) >> 11);
-          // Q7 + (Q14 * Q15 >> 22) = Q7.
-          nmk2 = nmk + (int16_t)((delt * kNoiseUpdateConst) >> 22);
-        }
+      tmp_s16 = (int16_t) (noise_global_mean >> 6);  // Q8
+      noise_mean_q8[channel] = tmp_s16;
+      noise_mean_q8[channel + kNumChannels] = tmp_s16;
+    }
 
-        // Long term correction of the noise mean.
-        // Q8 - Q8 = Q8.
-        ndelt = (feature_minimum << 4) - tmp1_s16;
-        // Q7 + (Q8 * Q8) >> 9 = Q7.
-        nmk3 = nmk2 + (int16_t)((ndelt * kBackEta) >> 9);
-
-        // Control that the noise mean does not drift to much.
-        tmp_s16 = (int16_t) ((k + 5) << 7);
-        if (nmk3 < tmp_s16) {
-          nmk3 = tmp_s16;
-        }
-        tmp_s16 = (int16_t) ((72 + k - channel) << 7);
-        if (nmk3 > tmp_s16) {
-          nmk3 = tmp_s16;
-        }
-        self->noise_means[gaussian] = nmk3;
-
-        if (vadflag) {
-          // Update speech mean vector:
-          // |deltaS| = (x-mu)/sigma^2
-          // sgprvec[k] = |speech_probability[k]| /
-          //   (|speech_probability[0]| + |speech_probability[1]|)
-
-          // (Q14 * Q11) >> 11 = Q14.
-          delt = (int16_t)((sgprvec[gaussian] * deltaS[gaussian]) >> 11);
-          // Q14 * Q15 >> 21 = Q8.
-          tmp_s16 = (int16_t)((delt * kSpeechUpdateConst) >> 21);
-          // Q7 + (Q8 >> 1) = Q7. With rounding.
-          smk2 = smk + ((tmp_s16 + 1) >> 1);
-
-          // Control that the speech mean does not drift to much.
-          maxmu = maxspe + 640;
-          if (smk2 < kMinimumMean[k]) {
-            smk2 = kMinimumMean[k];
-          }
-          if (smk2 > maxmu) {
-            smk2 = maxmu;
-          }
-          self->speech_means[gaussian] = smk2;  // Q7.
-
-          // (Q7 >> 3) = Q4. With rounding.
-          tmp_s16 = ((smk + 4) >> 3);
-
-          tmp_s16 = features[channel] - tmp_s16;  // Q4
-          // (Q11 * Q4 >> 3) = Q12.
-          tmp1_s32 = (deltaS[gaussian] * tmp_s16) >> 3;
-          tmp2_s32 = tmp1_s32 - 4096;
-          tmp_s16 = sgprvec[gaussian] >> 2;
-          // (Q14 >> 2) * Q12 = Q24.
-          tmp1_s32 = tmp_s16 * tmp2_s32;
-
-          tmp2_s32 = tmp1_s32 >> 4;  // Q20
-
-          // 0.1 * Q20 / Q7 = Q13.
-          if (tmp2_s32 > 0) {
-            tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(tmp2_s32, ssk * 10);
-          } else {
-            tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(-tmp2_s32, ssk * 10);
-            tmp_s16 = -tmp_s16;
-          }
-          // Divide by 4 giving an update factor of 0.025 (= 0.1 / 4).
-          // Note that division by 4 equals shift by 2, hence,
-          // (Q13 >> 8) = (Q13 >> 6) / 4 = Q7.
-          tmp_s16 += 128;  // Rounding.
-          ssk += (tmp_s16 >> 8);
-          if (ssk < kMinStd) {
-            ssk = kMinStd;
-          }
-          self->speech_stds[gaussian] = ssk;
-        } else {
-          // Update GMM variance vectors.
-          // deltaN * (features[channel] - nmk) - 1
-          // Q4 - (Q7 >> 3) = Q4.
-          tmp_s16 = features[channel] - (nmk >> 3);
-          // (Q11 * Q4 >> 3) = Q12.
-          tmp1_s32 = (deltaN[gaussian] * tmp_s16) >> 3;
-          tmp1_s32 -= 4096;
-
-          // (Q14 >> 2) * Q12 = Q24.
-          tmp_s16 = (ngprvec[gaussian] + 2) >> 2;
-          tmp2_s32 = tmp_s16 * tmp1_s32;
-          // Q20  * approx 0.001 (2^-10=0.0009766), hence,
-          // (Q24 >> 14) = (Q24 >> 4) / 2^10 = Q20.
-          tmp1_s32 = tmp2_s32 >> 14;
-
-          // Q20 / Q7 = Q13.
-          if (tmp1_s32 > 0) {
-            tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(tmp1_s32, nsk);
-          } else {
-            tmp_s16 = (int16_t) WebRtcSpl_DivW32W16(-tmp1_s32, nsk);
-            tmp_s16 = -tmp_s16;
-          }
-          tmp_s16 += 32;  // Rounding
-          nsk += tmp_s16 >> 6;  // Q13 >> 6 = Q7.
-          if (nsk < kMinStd) {
-            nsk = kMinStd;
-          }
-          self->noise_stds[gaussian] = nsk;
-        }
-      }
+    UpdateGaussians(self, gaussian_features, feature_minimum, noise_mean_q8,
+                    ngprvec, sgprvec, deltaN, deltaS, vadflag);
 
+    for (channel = 0; channel < kNumChannels; channel++) {
       // Separate models if they are too close.
       // |noise_global_mean| in Q14 (= Q7 * Q7).
       noise_global_mean = WeightedAverage(&self->noise_means[channel], 0,
@@ -442,8 +676,9 @@ static int16_t GmmProbability(VadInstT* self, int16_t* features,
         // Upper limit of speech model.
         tmp2_s16 -= maxspe;
 
-        for (k = 0; k < kNumGaussians; k++) {
-          self->speech_means[channel + k * kNumChannels] -= tmp2_s16;
+        for (gaussian = channel; gaussian < kTableSize;
+             gaussian += kNumChannels) {
+          self->speech_means[gaussian] -= tmp2_s16;
         }
       }
 
@@ -451,13 +686,17 @@ static int16_t GmmProbability(VadInstT* self, int16_t* features,
       if (tmp2_s16 > kMaximumNoise[channel]) {
         tmp2_s16 -= kMaximumNoise[channel];
 
-        for (k = 0; k < kNumGaussians; k++) {
-          self->noise_means[channel + k * kNumChannels] -= tmp2_s16;
+        for (gaussian = channel; gaussian < kTableSize;
+             gaussian += kNumChannels) {
+          self->noise_means[gaussian] -= tmp2_s16;
         }
       }
     }
     self->frame_counter++;
+  } else {
+    self->log_likelihood_ratio = 0;
   }
+  self->likelihood_threshold = totalTest;
 
   // Smooth with respect to transition hysteresis.
   if (!vadflag) {
@@ -491,6 +730,8 @@ int WebRtcVad_InitCore(VadInstT* self) {
   self->frame_counter = 0;
   self->over_hang = 0;
   self->num_of_speech = 0;
+  self->log_likelihood_ratio = 0;
+  self->likelihood_threshold = 0;
 
   // Initialization of downsampling filter state.
   memset(self->downsampling_filter_states, 0,
@@ -592,72 +833,77 @@ int WebRtcVad_set_mode_core(VadInstT* self, int mode) {
   return return_value;
 }
 
+// Downsamples |speech_frame| of rate |fs| to 8 kHz in |speech_nb|, which
+// holds up to 30 ms. Returns the frame to run the VAD on, |speech_frame|
+// itself at 8 kHz.
+static const int16_t* DownsampleTo8khz(VadInstT* inst, int fs,
+                                       const int16_t* speech_frame,
+                                       size_t frame_length,
+                                       int16_t* speech_nb) {
+  size_t i;
+
+  if (fs == 48000) {
+    const size_t kFrameLen10ms48khz = 480;
+    const size_t kFrameLen10ms8khz = 80;
+    size_t num_10ms_frames = frame_length / kFrameLen10ms48khz;
+    // Left uninitialized, it is written before being read.
+    int32_t scratch[kResampleScratchLength] VAD_SCRATCH_ALIGNED;
+
+    // As upstream, every 10 ms block is resampled from the start of
+    // |speech_frame|.
+    for (i = 0; i < num_10ms_frames; i++) {
+      WebRtcVad_Downsampling48khz(speech_frame,
+                                  &speech_nb[i * kFrameLen10ms8khz],
+                                  &inst->state_48_to_8, scratch);
+    }
+    return speech_nb;
+  } else if (fs == 32000) {
+    // Downsample signal 32->16->8 in one pass before doing VAD
+    WebRtcVad_Downsampling32khz(speech_frame, speech_nb,
+                                inst->downsampling_filter_states,
+                                frame_length);
+    return speech_nb;
+  } else if (fs == 16000) {
+    // Wideband: Downsample signal before doing VAD
+    WebRtcVad_Downsampling(speech_frame, speech_nb, inst->downsampling_filter_states,
+                           frame_length);
+    return speech_nb;
+  }
+  return speech_frame;
+}
+
 // Calculate VAD decision by first extracting feature values and then calculate
 // probability for both speech and background noise.
 
 int WebRtcVad_CalcVad48khz(VadInstT* inst, const int16_t* speech_frame,
                            size_t frame_length) {
-  int vad;
-  size_t i;
   int16_t speech_nb[240];  // 30 ms in 8 kHz.
-  // |tmp_mem| is a temporary memory used by resample function, length is
-  // frame length in 10 ms (480 samples) + 256 extra.
-  int32_t tmp_mem[480 + 256] = { 0 };
-  const size_t kFrameLen10ms48khz = 480;
-  const size_t kFrameLen10ms8khz = 80;
-  size_t num_10ms_frames = frame_length / kFrameLen10ms48khz;
-
-  for (i = 0; i < num_10ms_frames; i++) {
-    WebRtcSpl_Resample48khzTo8khz(speech_frame,
-                                  &speech_nb[i * kFrameLen10ms8khz],
-                                  &inst->state_48_to_8,
-                                  tmp_mem);
-  }
 
-  // Do VAD on an 8 kHz signal
-  vad = WebRtcVad_CalcVad8khz(inst, speech_nb, frame_length / 6);
+  DownsampleTo8khz(inst, 48000, speech_frame, frame_length, speech_nb);
 
-  return vad;
+  // Do VAD on an 8 kHz signal
+  return WebRtcVad_CalcVad8khz(inst, speech_nb, frame_length / 6);
 }
 
 int WebRtcVad_CalcVad32khz(VadInstT* inst, const int16_t* speech_frame,
                            size_t frame_length)
 {
-    size_t len;
-    int vad;
-    int16_t speechWB[480]; // Downsampled speech frame: 960 samples (30ms in SWB)
     int16_t speechNB[240]; // Downsampled speech frame: 480 samples (30ms in WB)
 
-
-    // Downsample signal 32->16->8 before doing VAD
-    WebRtcVad_Downsampling(speech_frame, speechWB, &(inst->downsampling_filter_states[2]),
-                           frame_length);
-    len = frame_length / 2;
-
-    WebRtcVad_Downsampling(speechWB, speechNB, inst->downsampling_filter_states, len);
-    len /= 2;
+    DownsampleTo8khz(inst, 32000, speech_frame, frame_length, speechNB);
 
     // Do VAD on an 8 kHz signal
-    vad = WebRtcVad_CalcVad8khz(inst, speechNB, len);
-
-    return vad;
+    return WebRtcVad_CalcVad8khz(inst, speechNB, frame_length / 4);
 }
 
 int WebRtcVad_CalcVad16khz(VadInstT* inst, const int16_t* speech_frame,
                            size_t frame_length)
 {
-    size_t len;
-    int vad;
     int16_t speechNB[240]; // Downsampled speech frame: 480 samples (30ms in WB)
 
-    // Wideband: Downsample signal before doing VAD
-    WebRtcVad_Downsampling(speech_frame, speechNB, inst->downsampling_filter_states,
-                           frame_length);
-
-    len = frame_length / 2;
-    vad = WebRtcVad_CalcVad8khz(inst, speechNB, len);
+    DownsampleTo8khz(inst, 16000, speech_frame, frame_length, speechNB);
 
-    return vad;
+    return WebRtcVad_CalcVad8khz(inst, speechNB, frame_length / 2);
 }
 
 int WebRtcVad_CalcVad8khz(VadInstT* inst, const int16_t* speech_frame,
@@ -674,3 +920,41 @@ int WebRtcVad_CalcVad8khz(VadInstT* inst, const int16_t* speech_frame,
 
     return inst->vad;
 }
+
+void WebRtcVad_CalcVadBatch(VadInstT* const* insts, int fs,
+                            const int16_t* const* speech_frames,
+                            size_t frame_length, int count, int* vads)
+{
+    int16_t speech_nb[kMaxBatchSize][240];
+    const int16_t* frames_nb[kMaxBatchSize];
+    int16_t feature_vectors[kMaxBatchSize][kNumChannels];
+    int16_t total_power[kMaxBatchSize];
+    size_t length_nb = frame_length / (fs / 8000);
+    int i;
+
+    if (count <= 0) {
+        return;
+    }
+
+    // Run each stage over all instances before the next one, so that the code
+    // and tables of a stage stay in cache
+    if (fs == 16000 || fs == 32000) {
+        WebRtcVad_DownsamplingBatch(insts, fs, speech_frames, frame_length,
+                                    count, speech_nb);
+        for (i = 0; i < count; i++) {
+            frames_nb[i] = speech_nb[i];
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            frames_nb[i] = DownsampleTo8khz(insts[i], fs, speech_frames[i],
+                                            frame_length, speech_nb[i]);
+        }
+    }
+    WebRtcVad_CalculateFeaturesBatch(insts, frames_nb, length_nb, count,
+                                     feature_vectors, total_power);
+    for (i = 0; i < count; i++) {
+        insts[i]->vad = GmmProbability(insts[i], feature_vectors[i], total_power[i],
+                                       length_nb);
+        vads[i] = insts[i]->vad;
+    }
+}
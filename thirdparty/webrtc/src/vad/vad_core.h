@@ -23,6 +23,15 @@ enum { kNumChannels = 6 };  // Number of frequency bands (named channels).
 enum { kNumGaussians = 2 };  // Number of Gaussians per channel in the GMM.
 enum { kTableSize = kNumChannels * kNumGaussians };
 enum { kMinEnergy = 10 };  // Minimum energy required to trigger audio signal.
+enum { kMaxBatchSize = 16 };  // Maximum instances of WebRtcVad_CalcVadBatch().
+
+// The Gaussian model tables are loaded four Gaussians (8 bytes) at a time by
+// GmmProbability().
+#if defined(__GNUC__)
+#define VAD_TABLE_ALIGNED __attribute__((aligned(8)))
+#else
+#define VAD_TABLE_ALIGNED
+#endif
 
 typedef struct VadInstT_
 {
@@ -30,10 +39,10 @@ typedef struct VadInstT_
     int vad;
     int32_t downsampling_filter_states[4];
     WebRtcSpl_State48khzTo8khz state_48_to_8;
-    int16_t noise_means[kTableSize];
-    int16_t speech_means[kTableSize];
-    int16_t noise_stds[kTableSize];
-    int16_t speech_stds[kTableSize];
+    int16_t noise_means[kTableSize] VAD_TABLE_ALIGNED;
+    int16_t speech_means[kTableSize] VAD_TABLE_ALIGNED;
+    int16_t noise_stds[kTableSize] VAD_TABLE_ALIGNED;
+    int16_t speech_stds[kTableSize] VAD_TABLE_ALIGNED;
     // TODO(bjornv): Change to |frame_count|.
     int32_t frame_counter;
     int16_t over_hang; // Over Hang
@@ -50,6 +59,10 @@ typedef struct VadInstT_
     int16_t over_hang_max_2[3];
     int16_t individual[3];
     int16_t total[3];
+    // Global log likelihood ratio of the last frame and the threshold it was
+    // tested against, 0 if the frame had too little energy to be tested.
+    int32_t log_likelihood_ratio;
+    int16_t likelihood_threshold;
 
     int init_flag;
 
@@ -112,4 +125,27 @@ int WebRtcVad_CalcVad16khz(VadInstT* inst, const int16_t* speech_frame,
 int WebRtcVad_CalcVad8khz(VadInstT* inst, const int16_t* speech_frame,
                           size_t frame_length);
 
+/****************************************************************************
+ * WebRtcVad_CalcVadBatch(...)
+ *
+ * Calculate VAD decisions of one frame for each of |count| instances, stage
+ * by stage over all instances. Same results as calling WebRtcVad_CalcVadXkhz()
+ * for each instance.
+ *
+ * Input:
+ *      - insts         : Instances, at most |kMaxBatchSize|
+ *      - fs            : Sampling frequency of all frames
+ *      - speech_frames : Input speech frame of each instance
+ *      - frame_length  : Number of input samples of each frame
+ *      - count         : Number of instances
+ *
+ * Output:
+ *      - insts         : Updated filter states etc.
+ *      - vads          : VAD decision of each instance, 0 - No active speech,
+ *                        1-6 - Active speech
+ */
+void WebRtcVad_CalcVadBatch(VadInstT* const* insts, int fs,
+                            const int16_t* const* speech_frames,
+                            size_t frame_length, int count, int* vads);
+
 #endif  // WEBRTC_COMMON_AUDIO_VAD_VAD_CORE_H_
@@ -11,8 +11,10 @@
 #include "vad_filterbank.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "signal_processing/signal_processing_library.h"
+#include "vad_sp.h"
 #include "typedefs.h"
 
 // Constants used in LogOfEnergy().
@@ -140,32 +142,18 @@ static void SplitFilter(const int16_t* data_in, size_t data_length,
   }
 }
 
-// Calculates the energy of |data_in| in dB, and also updates an overall
-// |total_energy| if necessary.
+// Second half of LogOfEnergy(), from the energy of |data_in| as given by
+// WebRtcSpl_Energy().
 //
-// - data_in      [i]   : Input audio data for energy calculation.
-// - data_length  [i]   : Length of input data.
+// - energy       [i]   : Energy of the input data, in Q(-|tot_rshifts|).
+// - tot_rshifts  [i]   : Right shifts performed on |energy|.
 // - offset       [i]   : Offset value added to |log_energy|.
-// - total_energy [i/o] : An external energy updated with the energy of
-//                        |data_in|.
-//                        NOTE: |total_energy| is only updated if
-//                        |total_energy| <= |kMinEnergy|.
+// - total_energy [i/o] : See LogOfEnergy().
 // - log_energy   [o]   : 10 * log10("energy of |data_in|") given in Q4.
-static void LogOfEnergy(const int16_t* data_in, size_t data_length,
-                        int16_t offset, int16_t* total_energy,
-                        int16_t* log_energy) {
-  // |tot_rshifts| accumulates the number of right shifts performed on |energy|.
-  int tot_rshifts = 0;
+static void EnergyToLogEnergy(uint32_t energy, int tot_rshifts, int16_t offset,
+                              int16_t* total_energy, int16_t* log_energy) {
   // The |energy| will be normalized to 15 bits. We use unsigned integer because
   // we eventually will mask out the fractional part.
-  uint32_t energy = 0;
-
-  assert(data_in != NULL);
-  assert(data_length > 0);
-
-  energy = (uint32_t) WebRtcSpl_Energy((int16_t*) data_in, data_length,
-                                       &tot_rshifts);
-
   if (energy != 0) {
     // By construction, normalizing to 15 bits is equivalent with 17 leading
     // zeros of an unsigned 32 bit value.
@@ -242,6 +230,32 @@ static void LogOfEnergy(const int16_t* data_in, size_t data_length,
   }
 }
 
+// Calculates the energy of |data_in| in dB, and also updates an overall
+// |total_energy| if necessary.
+//
+// - data_in      [i]   : Input audio data for energy calculation.
+// - data_length  [i]   : Length of input data.
+// - offset       [i]   : Offset value added to |log_energy|.
+// - total_energy [i/o] : An external energy updated with the energy of
+//                        |data_in|.
+//                        NOTE: |total_energy| is only updated if
+//                        |total_energy| <= |kMinEnergy|.
+// - log_energy   [o]   : 10 * log10("energy of |data_in|") given in Q4.
+static void LogOfEnergy(const int16_t* data_in, size_t data_length,
+                        int16_t offset, int16_t* total_energy,
+                        int16_t* log_energy) {
+  // |tot_rshifts| accumulates the number of right shifts performed on |energy|.
+  int tot_rshifts = 0;
+  uint32_t energy = 0;
+
+  assert(data_in != NULL);
+  assert(data_length > 0);
+
+  energy = (uint32_t) WebRtcSpl_Energy((int16_t*) data_in, data_length,
+                                       &tot_rshifts);
+  EnergyToLogEnergy(energy, tot_rshifts, offset, total_energy, log_energy);
+}
+
 int16_t WebRtcVad_CalculateFeatures(VadInstT* self, const int16_t* data_in,
                                     size_t data_length, int16_t* features) {
   int16_t total_energy = 0;
@@ -329,3 +343,256 @@ int16_t WebRtcVad_CalculateFeatures(VadInstT* self, const int16_t* data_in,
 
   return total_energy;
 }
+
+// Lane kernels: the filters are recursive, so instead of vectorizing along
+// the samples of one frame, each lane of a vector runs the same filter for
+// another VAD instance. Samples are kept in int32 lanes and wrapped to 16
+// bits wherever the scalar code stores to an int16_t, hence the results are
+// bit exact. The kernels are written once with GCC vector extensions in
+// vad_filterbank_lanes.h, for 4 lanes (SSE4.1, NEON) and 8 lanes (AVX2), and
+// compiled per instruction set, see WebRtcVad_CalculateFeaturesBatch().
+// VAD_DISABLE_LANES keeps the scalar code, as does WebRtcVad_SetBatchLanes(1).
+#if defined(__GNUC__) && !defined(VAD_DISABLE_LANES) && \
+    (defined(WEBRTC_ARCH_X86_FAMILY) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define VAD_FILTERBANK_LANES
+
+// Fewer instances are cheaper on the scalar path.
+enum { kMinBatchLanes = 2 };
+
+#define VAD_LANES_INLINE static __inline __attribute__((always_inline))
+
+// Wraps each lane to int16_t, as a store to an int16_t does.
+#define WRAP16(x) (((x) << 16) >> 16)
+
+// Allpass filter coefficients of WebRtcVad_Downsampling(), in Q13.
+static const int16_t kAllPassCoefsQ13[2] = { 5243, 1392 };
+
+typedef int32_t LaneVector4 __attribute__((vector_size(16)));
+#define LANES 4
+#define LaneVector LaneVector4
+#define LANES_FN(fn) fn##4
+#include "vad_filterbank_lanes.h"
+#undef LANES
+#undef LaneVector
+#undef LANES_FN
+
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+typedef int32_t LaneVector8 __attribute__((vector_size(32)));
+#define LANES 8
+#define LaneVector LaneVector8
+#define LANES_FN(fn) fn##8
+#include "vad_filterbank_lanes.h"
+#undef LANES
+#undef LaneVector
+#undef LANES_FN
+#endif
+
+typedef void (*CalculateFeaturesLanesFn)(VadInstT* const* insts,
+                                         const int16_t* const* data_in,
+                                         size_t data_length, int lanes,
+                                         int16_t (*features)[kNumChannels],
+                                         int16_t* total_energy);
+typedef void (*DownsamplingLanesFn)(VadInstT* const* insts,
+                                    const int16_t* const* data_in,
+                                    size_t in_length, int factor, int lanes,
+                                    int16_t (*data_out)[240]);
+
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+__attribute__((target("avx2")))
+static void CalculateFeaturesAvx2(VadInstT* const* insts,
+                                  const int16_t* const* data_in,
+                                  size_t data_length, int lanes,
+                                  int16_t (*features)[kNumChannels],
+                                  int16_t* total_energy) {
+  CalculateFeaturesLanes8(insts, data_in, data_length, lanes, features,
+                          total_energy);
+}
+
+__attribute__((target("sse4.1")))
+static void CalculateFeaturesSse41(VadInstT* const* insts,
+                                   const int16_t* const* data_in,
+                                   size_t data_length, int lanes,
+                                   int16_t (*features)[kNumChannels],
+                                   int16_t* total_energy) {
+  CalculateFeaturesLanes4(insts, data_in, data_length, lanes, features,
+                          total_energy);
+}
+
+__attribute__((target("avx2")))
+static void DownsamplingAvx2(VadInstT* const* insts,
+                             const int16_t* const* data_in,
+                             size_t in_length, int factor, int lanes,
+                             int16_t (*data_out)[240]) {
+  DownsamplingLanes8(insts, data_in, in_length, factor, lanes, data_out);
+}
+
+__attribute__((target("sse4.1")))
+static void DownsamplingSse41(VadInstT* const* insts,
+                              const int16_t* const* data_in,
+                              size_t in_length, int factor, int lanes,
+                              int16_t (*data_out)[240]) {
+  DownsamplingLanes4(insts, data_in, in_length, factor, lanes, data_out);
+}
+
+// Lanes of the best kernels of the cpu, 0 if it lacks SSE4.1 (32-bit lane
+// multiply).
+static int CpuLanes(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return 8;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return 4;
+  }
+  return 0;
+}
+
+// Kernels of |lanes| lanes, 0 for the best of the cpu. Returns their lanes, 0
+// if the cpu lacks them.
+static int SelectKernels(int lanes, CalculateFeaturesLanesFn* features_fn,
+                         DownsamplingLanesFn* downsampling_fn) {
+  int cpu_lanes = CpuLanes();
+  if (lanes == 0) {
+    lanes = cpu_lanes;
+  }
+  if (lanes > cpu_lanes) {
+    return 0;
+  }
+  if (lanes == 8) {
+    *features_fn = CalculateFeaturesAvx2;
+    *downsampling_fn = DownsamplingAvx2;
+    return 8;
+  }
+  if (lanes == 4) {
+    *features_fn = CalculateFeaturesSse41;
+    *downsampling_fn = DownsamplingSse41;
+    return 4;
+  }
+  return 0;
+}
+#else
+static void CalculateFeaturesNeon(VadInstT* const* insts,
+                                  const int16_t* const* data_in,
+                                  size_t data_length, int lanes,
+                                  int16_t (*features)[kNumChannels],
+                                  int16_t* total_energy) {
+  CalculateFeaturesLanes4(insts, data_in, data_length, lanes, features,
+                          total_energy);
+}
+
+static void DownsamplingNeon(VadInstT* const* insts,
+                             const int16_t* const* data_in,
+                             size_t in_length, int factor, int lanes,
+                             int16_t (*data_out)[240]) {
+  DownsamplingLanes4(insts, data_in, in_length, factor, lanes, data_out);
+}
+
+static int SelectKernels(int lanes, CalculateFeaturesLanesFn* features_fn,
+                         DownsamplingLanesFn* downsampling_fn) {
+  if (lanes != 0 && lanes != 4) {
+    return 0;
+  }
+  *features_fn = CalculateFeaturesNeon;
+  *downsampling_fn = DownsamplingNeon;
+  return 4;
+}
+#endif
+
+// Kernels of the batch functions, |g_max_lanes| is 0 until they are selected
+// and -1 for the scalar path.
+static int g_max_lanes = 0;
+static CalculateFeaturesLanesFn g_features_lanes_fn = NULL;
+static DownsamplingLanesFn g_downsampling_lanes_fn = NULL;
+
+static void SetKernels(int lanes) {
+  CalculateFeaturesLanesFn features_fn = NULL;
+  DownsamplingLanesFn downsampling_fn = NULL;
+  if (lanes != 1) {
+    lanes = SelectKernels(lanes, &features_fn, &downsampling_fn);
+  }
+  g_features_lanes_fn = lanes > 1 ? features_fn : NULL;
+  g_downsampling_lanes_fn = lanes > 1 ? downsampling_fn : NULL;
+  g_max_lanes = lanes > 1 ? lanes : -1;
+}
+
+static int MaxLanes(void) {
+  // Selected once, a racing caller may take the scalar path meanwhile.
+  if (g_max_lanes == 0) {
+    SetKernels(0);
+  }
+  return g_max_lanes;
+}
+
+#endif  // VAD_FILTERBANK_LANES
+
+void WebRtcVad_CalculateFeaturesBatch(VadInstT* const* insts,
+                                      const int16_t* const* data_in,
+                                      size_t data_length, int count,
+                                      int16_t (*features)[kNumChannels],
+                                      int16_t* total_energy) {
+  int i = 0;
+
+#ifdef VAD_FILTERBANK_LANES
+  const int max_lanes = MaxLanes();
+  const CalculateFeaturesLanesFn lanes_fn = g_features_lanes_fn;
+
+  while (lanes_fn != NULL && count - i >= kMinBatchLanes) {
+    int lanes = count - i < max_lanes ? count - i : max_lanes;
+    lanes_fn(&insts[i], &data_in[i], data_length, lanes, &features[i],
+             &total_energy[i]);
+    i += lanes;
+  }
+#endif
+
+  for (; i < count; i++) {
+    total_energy[i] = WebRtcVad_CalculateFeatures(insts[i], data_in[i],
+                                                  data_length, features[i]);
+  }
+}
+
+void WebRtcVad_DownsamplingBatch(VadInstT* const* insts, int fs,
+                                 const int16_t* const* data_in,
+                                 size_t in_length, int count,
+                                 int16_t (*data_out)[240]) {
+  const int factor = fs / 8000;
+  int i = 0;
+
+  assert(fs == 16000 || fs == 32000);
+
+#ifdef VAD_FILTERBANK_LANES
+  const int max_lanes = MaxLanes();
+  const DownsamplingLanesFn lanes_fn = g_downsampling_lanes_fn;
+
+  while (lanes_fn != NULL && count - i >= kMinBatchLanes) {
+    int lanes = count - i < max_lanes ? count - i : max_lanes;
+    lanes_fn(&insts[i], &data_in[i], in_length, factor, lanes, &data_out[i]);
+    i += lanes;
+  }
+#endif
+
+  for (; i < count; i++) {
+    if (factor == 4) {
+      WebRtcVad_Downsampling32khz(data_in[i], data_out[i],
+                                  insts[i]->downsampling_filter_states,
+                                  in_length);
+    } else {
+      WebRtcVad_Downsampling(data_in[i], data_out[i],
+                             insts[i]->downsampling_filter_states, in_length);
+    }
+  }
+}
+
+int WebRtcVad_SetBatchLanes(int lanes) {
+#ifdef VAD_FILTERBANK_LANES
+  CalculateFeaturesLanesFn features_fn = NULL;
+  DownsamplingLanesFn downsampling_fn = NULL;
+  if (lanes < 0 ||
+      (lanes > 1 && SelectKernels(lanes, &features_fn, &downsampling_fn) == 0)) {
+    return -1;
+  }
+  SetKernels(lanes);
+  return g_max_lanes > 1 ? g_max_lanes : 1;
+#else
+  return lanes == 0 || lanes == 1 ? 1 : -1;
+#endif
+}
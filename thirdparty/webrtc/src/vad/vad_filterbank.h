@@ -41,4 +41,50 @@
 int16_t WebRtcVad_CalculateFeatures(VadInstT* self, const int16_t* data_in,
                                     size_t data_length, int16_t* features);
 
+// WebRtcVad_CalculateFeatures() of |count| instances, each on its own
+// |data_in|, all of |data_length| samples. Where the compiler and cpu allow,
+// the instances run side by side in the lanes of SIMD vectors (AVX2, SSE4.1
+// or NEON), picked at run time. Results are the same as one call per
+// instance.
+//
+// - insts        [i/o] : VAD instances.
+// - data_in      [i]   : Input audio data of each instance.
+// - data_length  [i]   : Audio data size, in number of samples.
+// - count        [i]   : Number of instances.
+// - features     [o]   : Features of each instance, see
+//                        WebRtcVad_CalculateFeatures().
+// - total_energy [o]   : Total energy of each instance.
+void WebRtcVad_CalculateFeaturesBatch(VadInstT* const* insts,
+                                      const int16_t* const* data_in,
+                                      size_t data_length, int count,
+                                      int16_t (*features)[kNumChannels],
+                                      int16_t* total_energy);
+
+// Downsamples 16 or 32 kHz input of |count| instances to 8 kHz, as
+// WebRtcVad_Downsampling() or WebRtcVad_Downsampling32khz() would with the
+// |downsampling_filter_states| of each. Runs in SIMD lanes like
+// WebRtcVad_CalculateFeaturesBatch().
+//
+// - insts        [i/o] : VAD instances.
+// - fs           [i]   : Sampling rate of the input, 16000 or 32000.
+// - data_in      [i]   : Input audio data of each instance.
+// - in_length    [i]   : Input audio data size, in number of samples.
+// - count        [i]   : Number of instances.
+// - data_out     [o]   : Downsampled audio data of each instance, of
+//                        |in_length| * 8000 / |fs| samples.
+void WebRtcVad_DownsamplingBatch(VadInstT* const* insts, int fs,
+                                 const int16_t* const* data_in,
+                                 size_t in_length, int count,
+                                 int16_t (*data_out)[240]);
+
+// Sets the SIMD lanes of the batch functions above, for tests and benchmarks.
+// By default they use the widest kernels of the cpu.
+//
+// - lanes        [i]   : 0 for the widest kernels of the cpu, 1 for the scalar
+//                        path, or 4 or 8 for kernels of that many lanes.
+// - returns            : Lanes in use, 1 for the scalar path, or -1 if the
+//                        build or cpu lacks kernels of |lanes| lanes, in which
+//                        case the setting is left as it was.
+int WebRtcVad_SetBatchLanes(int lanes);
+
 #endif  // WEBRTC_COMMON_AUDIO_VAD_VAD_FILTERBANK_H_
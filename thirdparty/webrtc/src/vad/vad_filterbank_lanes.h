@@ -0,0 +1,320 @@
+/*
+ *  Copyright (c) 2012 The WebRTC project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+// Lane kernels of vad_filterbank.c, included once per vector width with
+//   LANES        : number of int32_t lanes of LaneVector.
+//   LaneVector   : vector type of LANES int32_t.
+//   LANES_FN(fn) : name of the width specific version of fn.
+// Not a header of its own.
+
+// Width specific names of the kernels, LANES_FN() pastes its argument
+// unexpanded.
+#define HighPassFilterLanes LANES_FN(HighPassFilterLanes)
+#define AllPassFilterLanes LANES_FN(AllPassFilterLanes)
+#define SplitFilterLanes LANES_FN(SplitFilterLanes)
+#define EnergyLanes LANES_FN(EnergyLanes)
+#define LogOfEnergyLanes LANES_FN(LogOfEnergyLanes)
+#define CalculateFeaturesLanes LANES_FN(CalculateFeaturesLanes)
+#define DownsamplingAllPassLanes LANES_FN(DownsamplingAllPassLanes)
+#define DownsamplingLanes LANES_FN(DownsamplingLanes)
+
+// HighPassFilter() of each lane.
+VAD_LANES_INLINE void HighPassFilterLanes(const LaneVector* data_in,
+                                          size_t data_length,
+                                          LaneVector* filter_state,
+                                          LaneVector* data_out) {
+  size_t i;
+  LaneVector tmp32;
+
+  for (i = 0; i < data_length; i++) {
+    tmp32 = kHpZeroCoefs[0] * data_in[i];
+    tmp32 += kHpZeroCoefs[1] * filter_state[0];
+    tmp32 += kHpZeroCoefs[2] * filter_state[1];
+    filter_state[1] = filter_state[0];
+    filter_state[0] = data_in[i];
+
+    tmp32 -= kHpPoleCoefs[1] * filter_state[2];
+    tmp32 -= kHpPoleCoefs[2] * filter_state[3];
+    filter_state[3] = filter_state[2];
+    filter_state[2] = WRAP16(tmp32 >> 14);
+    data_out[i] = filter_state[2];
+  }
+}
+
+// AllPassFilter() of each lane. |filter_state| is kept in Q15 like the local
+// state of the scalar version.
+VAD_LANES_INLINE void AllPassFilterLanes(const LaneVector* data_in,
+                                         size_t data_length,
+                                         int16_t filter_coefficient,
+                                         LaneVector* filter_state,
+                                         LaneVector* data_out) {
+  size_t i;
+  LaneVector tmp16;
+  LaneVector state32 = *filter_state << 16;  // Q15
+
+  for (i = 0; i < data_length; i++) {
+    // The arithmetic shift of an int32_t by 16 fits in an int16_t.
+    tmp16 = (state32 + filter_coefficient * *data_in) >> 16;  // Q(-1)
+    *data_out++ = tmp16;
+    state32 = ((*data_in << 14) - filter_coefficient * tmp16) << 1;  // Q15
+    data_in += 2;
+  }
+
+  *filter_state = state32 >> 16;  // Q(-1)
+}
+
+// SplitFilter() of each lane.
+VAD_LANES_INLINE void SplitFilterLanes(const LaneVector* data_in,
+                                       size_t data_length,
+                                       LaneVector* upper_state,
+                                       LaneVector* lower_state,
+                                       LaneVector* hp_data_out,
+                                       LaneVector* lp_data_out) {
+  size_t i;
+  size_t half_length = data_length >> 1;
+  LaneVector tmp_out;
+
+  AllPassFilterLanes(&data_in[0], half_length, kAllPassCoefsQ15[0],
+                     upper_state, hp_data_out);
+  AllPassFilterLanes(&data_in[1], half_length, kAllPassCoefsQ15[1],
+                     lower_state, lp_data_out);
+
+  for (i = 0; i < half_length; i++) {
+    tmp_out = hp_data_out[i];
+    hp_data_out[i] = WRAP16(hp_data_out[i] - lp_data_out[i]);
+    lp_data_out[i] = WRAP16(lp_data_out[i] + tmp_out);
+  }
+}
+
+// WebRtcSpl_Energy() of each lane, |tot_rshifts| gets the scaling of each.
+VAD_LANES_INLINE void EnergyLanes(const LaneVector* data_in,
+                                  size_t data_length, LaneVector* energy,
+                                  LaneVector* tot_rshifts) {
+  size_t i;
+  int lane;
+  int16_t nbits = WebRtcSpl_GetSizeInBits((uint32_t) data_length);
+  LaneVector smax = { 0 };
+  LaneVector sabs, mask, en = { 0 };
+
+  // Same as WebRtcSpl_GetScalingSquare(), including the absolute value of
+  // -32768 which wraps to itself. Comparisons give all ones in true lanes.
+  for (i = 0; i < data_length; i++) {
+    mask = data_in[i] > 0;
+    sabs = WRAP16((data_in[i] & mask) | (-data_in[i] & ~mask));
+    mask = sabs > smax;
+    smax = (sabs & mask) | (smax & ~mask);
+  }
+  for (lane = 0; lane < LANES; lane++) {
+    int16_t t = WebRtcSpl_NormW32(smax[lane] * smax[lane]);
+    (*tot_rshifts)[lane] = (smax[lane] == 0 || t > nbits) ? 0 : nbits - t;
+  }
+
+  for (i = 0; i < data_length; i++) {
+    en += (data_in[i] * data_in[i]) >> *tot_rshifts;
+  }
+  *energy = en;
+}
+
+// LogOfEnergy() of each active lane.
+VAD_LANES_INLINE void LogOfEnergyLanes(const LaneVector* data_in,
+                                       size_t data_length, int lanes,
+                                       int feature, int16_t* total_energy,
+                                       int16_t (*features)[kNumChannels]) {
+  int lane;
+  LaneVector energy, tot_rshifts;
+
+  EnergyLanes(data_in, data_length, &energy, &tot_rshifts);
+  for (lane = 0; lane < lanes; lane++) {
+    EnergyToLogEnergy((uint32_t) energy[lane], tot_rshifts[lane],
+                      kOffsetVector[feature], &total_energy[lane],
+                      &features[lane][feature]);
+  }
+}
+
+// WebRtcVad_CalculateFeatures() of up to LANES instances. Unused lanes
+// run on zeros and are dropped.
+VAD_LANES_INLINE void CalculateFeaturesLanes(VadInstT* const* insts,
+                                             const int16_t* const* data_in,
+                                             size_t data_length, int lanes,
+                                             int16_t (*features)[kNumChannels],
+                                             int16_t* total_energy) {
+  LaneVector in_240[240];
+  LaneVector hp_120[120], lp_120[120];
+  LaneVector hp_60[60], lp_60[60];
+  LaneVector upper_state[kNumChannels - 1], lower_state[kNumChannels - 1];
+  LaneVector hp_filter_state[4];
+  const size_t half_data_length = data_length >> 1;
+  size_t length = half_data_length;
+  size_t i;
+  int band, lane;
+
+  assert(data_length <= 240);
+
+  // Transpose input and filter states to lanes.
+  memset(in_240, 0, sizeof(LaneVector) * data_length);
+  memset(upper_state, 0, sizeof(upper_state));
+  memset(lower_state, 0, sizeof(lower_state));
+  memset(hp_filter_state, 0, sizeof(hp_filter_state));
+  for (lane = 0; lane < lanes; lane++) {
+    for (i = 0; i < data_length; i++) {
+      in_240[i][lane] = data_in[lane][i];
+    }
+    for (band = 0; band < kNumChannels - 1; band++) {
+      upper_state[band][lane] = insts[lane]->upper_state[band];
+      lower_state[band][lane] = insts[lane]->lower_state[band];
+    }
+    for (i = 0; i < 4; i++) {
+      hp_filter_state[i][lane] = insts[lane]->hp_filter_state[i];
+    }
+    total_energy[lane] = 0;
+  }
+
+  // Same stages as WebRtcVad_CalculateFeatures().
+  SplitFilterLanes(in_240, data_length, &upper_state[0], &lower_state[0],
+                   hp_120, lp_120);
+
+  SplitFilterLanes(hp_120, length, &upper_state[1], &lower_state[1],
+                   hp_60, lp_60);
+  length >>= 1;
+  LogOfEnergyLanes(hp_60, length, lanes, 5, total_energy, features);
+  LogOfEnergyLanes(lp_60, length, lanes, 4, total_energy, features);
+
+  length = half_data_length;
+  SplitFilterLanes(lp_120, length, &upper_state[2], &lower_state[2],
+                   hp_60, lp_60);
+  length >>= 1;
+  LogOfEnergyLanes(hp_60, length, lanes, 3, total_energy, features);
+
+  SplitFilterLanes(lp_60, length, &upper_state[3], &lower_state[3],
+                   hp_120, lp_120);
+  length >>= 1;
+  LogOfEnergyLanes(hp_120, length, lanes, 2, total_energy, features);
+
+  SplitFilterLanes(lp_120, length, &upper_state[4], &lower_state[4],
+                   hp_60, lp_60);
+  length >>= 1;
+  LogOfEnergyLanes(hp_60, length, lanes, 1, total_energy, features);
+
+  HighPassFilterLanes(lp_60, length, hp_filter_state, hp_120);
+  LogOfEnergyLanes(hp_120, length, lanes, 0, total_energy, features);
+
+  // Store filter states back.
+  for (lane = 0; lane < lanes; lane++) {
+    for (band = 0; band < kNumChannels - 1; band++) {
+      insts[lane]->upper_state[band] = (int16_t) upper_state[band][lane];
+      insts[lane]->lower_state[band] = (int16_t) lower_state[band][lane];
+    }
+    for (i = 0; i < 4; i++) {
+      insts[lane]->hp_filter_state[i] = (int16_t) hp_filter_state[i][lane];
+    }
+  }
+}
+
+// One sample of an all-pass filter of WebRtcVad_Downsampling() in each lane.
+VAD_LANES_INLINE void DownsamplingAllPassLanes(const LaneVector* data_in,
+                                               int16_t coef,
+                                               LaneVector* state,
+                                               LaneVector* data_out) {
+  *data_out = WRAP16((*state >> 1) + ((coef * *data_in) >> 14));
+  *state = *data_in - ((coef * *data_out) >> 12);
+}
+
+// WebRtcVad_Downsampling() from 16 kHz (|factor| 2) or
+// WebRtcVad_Downsampling32khz() from 32 kHz (|factor| 4) of up to LANES
+// instances. The input is moved to lanes a few samples at a time, unused
+// lanes run on zeros and are dropped.
+VAD_LANES_INLINE void DownsamplingLanes(VadInstT* const* insts,
+                                        const int16_t* const* data_in,
+                                        size_t in_length, int factor,
+                                        int lanes,
+                                        int16_t (*data_out)[240]) {
+  enum { kChunkLength = 16 };  // Output samples of one transpose.
+  LaneVector in_chunk[4 * kChunkLength];
+  LaneVector out_chunk[kChunkLength];
+  LaneVector state[4];
+  LaneVector upper, lower, tmp16_1, tmp16_2;
+  const size_t out_length = in_length / factor;
+  size_t n, i, chunk_length;
+  int lane;
+
+  assert(factor == 2 || factor == 4);
+  assert(out_length <= 240);
+
+  memset(in_chunk, 0, sizeof(in_chunk));
+  memset(state, 0, sizeof(state));
+  for (lane = 0; lane < lanes; lane++) {
+    for (i = 0; i < 4; i++) {
+      state[i][lane] = insts[lane]->downsampling_filter_states[i];
+    }
+  }
+
+  for (n = 0; n < out_length; n += chunk_length) {
+    chunk_length = out_length - n < kChunkLength ? out_length - n :
+        kChunkLength;
+    for (lane = 0; lane < lanes; lane++) {
+      const int16_t* in_ptr = &data_in[lane][n * factor];
+      for (i = 0; i < chunk_length * factor; i++) {
+        in_chunk[i][lane] = in_ptr[i];
+      }
+    }
+
+    if (factor == 4) {
+      // Same order of filters as WebRtcVad_Downsampling32khz().
+      for (i = 0; i < chunk_length; i++) {
+        DownsamplingAllPassLanes(&in_chunk[4 * i], kAllPassCoefsQ13[0],
+                                 &state[2], &upper);
+        DownsamplingAllPassLanes(&in_chunk[4 * i + 1], kAllPassCoefsQ13[1],
+                                 &state[3], &lower);
+        tmp16_1 = WRAP16(upper + lower);
+        DownsamplingAllPassLanes(&in_chunk[4 * i + 2], kAllPassCoefsQ13[0],
+                                 &state[2], &upper);
+        DownsamplingAllPassLanes(&in_chunk[4 * i + 3], kAllPassCoefsQ13[1],
+                                 &state[3], &lower);
+        tmp16_2 = WRAP16(upper + lower);
+        DownsamplingAllPassLanes(&tmp16_1, kAllPassCoefsQ13[0], &state[0],
+                                 &upper);
+        DownsamplingAllPassLanes(&tmp16_2, kAllPassCoefsQ13[1], &state[1],
+                                 &lower);
+        out_chunk[i] = WRAP16(upper + lower);
+      }
+    } else {
+      for (i = 0; i < chunk_length; i++) {
+        DownsamplingAllPassLanes(&in_chunk[2 * i], kAllPassCoefsQ13[0],
+                                 &state[0], &upper);
+        DownsamplingAllPassLanes(&in_chunk[2 * i + 1], kAllPassCoefsQ13[1],
+                                 &state[1], &lower);
+        out_chunk[i] = WRAP16(upper + lower);
+      }
+    }
+
+    for (lane = 0; lane < lanes; lane++) {
+      for (i = 0; i < chunk_length; i++) {
+        data_out[lane][n + i] = (int16_t) out_chunk[i][lane];
+      }
+    }
+  }
+
+  // Store filter states back, from 16 kHz only those of the 16 -> 8 kHz
+  // stage are used.
+  for (lane = 0; lane < lanes; lane++) {
+    for (i = 0; i < (factor == 4 ? 4u : 2u); i++) {
+      insts[lane]->downsampling_filter_states[i] = state[i][lane];
+    }
+  }
+}
+
+#undef HighPassFilterLanes
+#undef AllPassFilterLanes
+#undef SplitFilterLanes
+#undef EnergyLanes
+#undef LogOfEnergyLanes
+#undef CalculateFeaturesLanes
+#undef DownsamplingAllPassLanes
+#undef DownsamplingLanes
@@ -11,11 +11,16 @@
 #include "vad_sp.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "signal_processing/signal_processing_library.h"
 #include "vad_core.h"
 #include "typedefs.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Allpass filter coefficients, upper and lower, in Q13.
 // Upper: 0.64, Lower: 0.17.
 static const int16_t kAllPassCoefsQ13[2] = { 5243, 1392 };  // Q13.
@@ -54,25 +59,329 @@ void WebRtcVad_Downsampling(const int16_t* signal_in,
   filter_state[1] = tmp32_2;
 }
 
-// Inserts |feature_value| into |low_value_vector|, if it is one of the 16
-// smallest values the last 100 frames. Then calculates and returns the median
-// of the five smallest values.
-int16_t WebRtcVad_FindMinimum(VadInstT* self,
-                              int16_t feature_value,
-                              int channel) {
+// One sample of an all-pass filter of WebRtcVad_Downsampling().
+static __inline int16_t DownsamplingAllPass(int16_t in, int16_t coef,
+                                            int32_t* state) {
+  int16_t out = (int16_t) ((*state >> 1) + ((coef * in) >> 14));
+
+  *state = (int32_t) in - ((coef * out) >> 12);
+  return out;
+}
+
+void WebRtcVad_Downsampling32khz(const int16_t* signal_in,
+                                 int16_t* signal_out,
+                                 int32_t* filter_state,
+                                 size_t in_length) {
+  int32_t state_16_8_upper = filter_state[0];
+  int32_t state_16_8_lower = filter_state[1];
+  int32_t state_32_16_upper = filter_state[2];
+  int32_t state_32_16_lower = filter_state[3];
+  int16_t tmp16_1, tmp16_2;
+  size_t n;
+  size_t quarter_length = (in_length >> 2);
+
+  // Two 16 kHz samples from four input samples, then one output sample from
+  // those. The four all-pass filters run interleaved.
+  for (n = 0; n < quarter_length; n++) {
+    tmp16_1 = (int16_t) (
+        DownsamplingAllPass(signal_in[0], kAllPassCoefsQ13[0],
+                            &state_32_16_upper) +
+        DownsamplingAllPass(signal_in[1], kAllPassCoefsQ13[1],
+                            &state_32_16_lower));
+    tmp16_2 = (int16_t) (
+        DownsamplingAllPass(signal_in[2], kAllPassCoefsQ13[0],
+                            &state_32_16_upper) +
+        DownsamplingAllPass(signal_in[3], kAllPassCoefsQ13[1],
+                            &state_32_16_lower));
+    signal_in += 4;
+
+    *signal_out++ = (int16_t) (
+        DownsamplingAllPass(tmp16_1, kAllPassCoefsQ13[0], &state_16_8_upper) +
+        DownsamplingAllPass(tmp16_2, kAllPassCoefsQ13[1], &state_16_8_lower));
+  }
+
+  filter_state[0] = state_16_8_upper;
+  filter_state[1] = state_16_8_lower;
+  filter_state[2] = state_32_16_upper;
+  filter_state[3] = state_32_16_lower;
+}
+
+// Coefficients of WebRtcSpl_Resample48khzTo8khz(), upper and lower all-pass
+// filters of the half band stages and the 48 -> 32 interpolation filters.
+static const int16_t kResampleAllpassUpper[3] = { 821, 6110, 12382 };
+static const int16_t kResampleAllpassLower[3] = { 3050, 9368, 15063 };
+static const int16_t kCoefficients48To32[2][8] = {
+  { 778, -2050, 1087, 23285, 12903, -3783, 441, 222 },
+  { 222, 441, -3783, 12903, 23285, 1087, -2050, 778 }
+};
+
+// Runs |in| through three first order all-pass filters with the four values
+// of |state|, as each branch of the resample_by_2_internal.c filters does.
+static __inline int32_t AllPassSection(int32_t in, int32_t* state,
+                                       const int16_t* coefs) {
+  int32_t tmp0, tmp1, diff;
+
+  diff = in - state[1];
+  // Scale down and round.
+  diff = (diff + (1 << 13)) >> 14;
+  tmp1 = state[0] + diff * coefs[0];
+  state[0] = in;
+  diff = tmp1 - state[2];
+  // Scale down and truncate.
+  diff = diff >> 14;
+  if (diff < 0)
+    diff += 1;
+  tmp0 = state[1] + diff * coefs[1];
+  state[1] = tmp1;
+  diff = tmp0 - state[3];
+  // Scale down and truncate.
+  diff = diff >> 14;
+  if (diff < 0)
+    diff += 1;
+  state[3] = state[2] + diff * coefs[2];
+  state[2] = tmp0;
+
+  return state[3];
+}
+
+void WebRtcVad_Downsampling48khz(const int16_t* signal_in,
+                                 int16_t* signal_out,
+                                 WebRtcSpl_State48khzTo8khz* state,
+                                 int32_t* scratch) {
+  // Filter states are kept in locals, they would be reloaded after every
+  // store to |scratch| otherwise.
+  int32_t state_48_24[8], state_24_24[16], state_16_8[8];
+  int32_t tmp0, tmp1;
+  const int32_t* in32 = scratch;
+  size_t i;
+
+  memcpy(state_48_24, state->S_48_24, sizeof(state_48_24));
+  memcpy(state_24_24, state->S_24_24, sizeof(state_24_24));
+  memcpy(state_16_8, state->S_16_8, sizeof(state_16_8));
+
+  // 48 -> 24 kHz and the 24 kHz lowpass, two 24 kHz samples at a time, after
+  // the last 8 lowpass samples of the previous call.
+  memcpy(scratch, state->S_24_16, sizeof(state->S_24_16));
+  for (i = 0; i < 120; i++) {
+    tmp0 = (AllPassSection(((int32_t)signal_in[0] << 15) + (1 << 14),
+                           &state_48_24[0], kResampleAllpassLower) >> 1) +
+        (AllPassSection(((int32_t)signal_in[1] << 15) + (1 << 14),
+                        &state_48_24[4], kResampleAllpassUpper) >> 1);
+    tmp1 = (AllPassSection(((int32_t)signal_in[2] << 15) + (1 << 14),
+                           &state_48_24[0], kResampleAllpassLower) >> 1) +
+        (AllPassSection(((int32_t)signal_in[3] << 15) + (1 << 14),
+                        &state_48_24[4], kResampleAllpassUpper) >> 1);
+    signal_in += 4;
+
+    // The even output takes the odd input of the previous pair, which is
+    // still held in |state_24_24[12]|.
+    scratch[8 + 2 * i] =
+        ((AllPassSection(state_24_24[12], &state_24_24[0],
+                         kResampleAllpassLower) >> 1) +
+         (AllPassSection(tmp0, &state_24_24[4],
+                         kResampleAllpassUpper) >> 1)) >> 15;
+    scratch[9 + 2 * i] =
+        ((AllPassSection(tmp0, &state_24_24[8],
+                         kResampleAllpassLower) >> 1) +
+         (AllPassSection(tmp1, &state_24_24[12],
+                         kResampleAllpassUpper) >> 1)) >> 15;
+  }
+  memcpy(state->S_24_16, &scratch[240], sizeof(state->S_24_16));
+
+  // 24 -> 16 kHz and 16 -> 8 kHz, each block of three 24 kHz samples gives
+  // one output sample.
+  for (i = 0; i < 80; i++) {
+    tmp0 = (1 << 14) +
+        kCoefficients48To32[0][0] * in32[0] +
+        kCoefficients48To32[0][1] * in32[1] +
+        kCoefficients48To32[0][2] * in32[2] +
+        kCoefficients48To32[0][3] * in32[3] +
+        kCoefficients48To32[0][4] * in32[4] +
+        kCoefficients48To32[0][5] * in32[5] +
+        kCoefficients48To32[0][6] * in32[6] +
+        kCoefficients48To32[0][7] * in32[7];
+    tmp1 = (1 << 14) +
+        kCoefficients48To32[1][0] * in32[1] +
+        kCoefficients48To32[1][1] * in32[2] +
+        kCoefficients48To32[1][2] * in32[3] +
+        kCoefficients48To32[1][3] * in32[4] +
+        kCoefficients48To32[1][4] * in32[5] +
+        kCoefficients48To32[1][5] * in32[6] +
+        kCoefficients48To32[1][6] * in32[7] +
+        kCoefficients48To32[1][7] * in32[8];
+    in32 += 3;
+
+    tmp0 = ((AllPassSection(tmp0, &state_16_8[0],
+                            kResampleAllpassLower) >> 1) +
+            (AllPassSection(tmp1, &state_16_8[4],
+                            kResampleAllpassUpper) >> 1)) >> 15;
+    if (tmp0 > (int32_t)0x00007FFF)
+      tmp0 = 0x00007FFF;
+    if (tmp0 < (int32_t)0xFFFF8000)
+      tmp0 = 0xFFFF8000;
+    signal_out[i] = (int16_t)tmp0;
+  }
+
+  memcpy(state->S_48_24, state_48_24, sizeof(state_48_24));
+  memcpy(state->S_24_24, state_24_24, sizeof(state_24_24));
+  memcpy(state->S_16_8, state_16_8, sizeof(state_16_8));
+}
+
+// The window of the 16 smallest values of a channel is kept sorted in two
+// vectors of 8 int16_t lanes, values and ages alike, and updated without
+// branches on the data. Only a second expired value in the same frame, which
+// is rare, takes another pass. VAD_DISABLE_LANES keeps the scalar code.
+#if defined(__GNUC__) && !defined(VAD_DISABLE_LANES) && \
+    (defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define VAD_SP_LANES
+
+typedef int16_t MinimumLanes __attribute__((vector_size(16)));
+typedef uint16_t MinimumULanes __attribute__((vector_size(16)));
+
+#define VAD_SP_INLINE static __inline __attribute__((always_inline))
+
+#define SELECT_LANES(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+// Lanes of |lanes| moved down by one, lane 0 of |next| entering at the top,
+// and moved up by one, the top lane of |previous| entering at the bottom.
+#if defined(__SSE2__)
+#define SHIFT_DOWN(lanes, next) ((MinimumLanes) _mm_or_si128( \
+    _mm_srli_si128((__m128i) (lanes), 2), _mm_slli_si128((__m128i) (next), 14)))
+#define SHIFT_UP(previous, lanes) ((MinimumLanes) _mm_or_si128( \
+    _mm_slli_si128((__m128i) (lanes), 2), \
+    _mm_srli_si128((__m128i) (previous), 14)))
+#elif defined(__clang__)
+#define SHIFT_DOWN(lanes, next) \
+  __builtin_shufflevector(lanes, next, 1, 2, 3, 4, 5, 6, 7, 8)
+#define SHIFT_UP(previous, lanes) \
+  __builtin_shufflevector(previous, lanes, 7, 8, 9, 10, 11, 12, 13, 14)
+#else
+#define SHIFT_DOWN(lanes, next) \
+  __builtin_shuffle(lanes, next, (MinimumLanes) { 1, 2, 3, 4, 5, 6, 7, 8 })
+#define SHIFT_UP(previous, lanes) \
+  __builtin_shuffle(previous, lanes, \
+                    (MinimumLanes) { 7, 8, 9, 10, 11, 12, 13, 14 })
+#endif
+
+static const MinimumLanes kLowLanes = { 0, 1, 2, 3, 4, 5, 6, 7 };
+static const MinimumLanes kHighLanes = { 8, 9, 10, 11, 12, 13, 14, 15 };
+
+// Returns the lane masks |low| and |high| as bits 0 - 7 and 8 - 15.
+VAD_SP_INLINE int LanesToBits(MinimumLanes low, MinimumLanes high) {
+#if defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_packs_epi16((__m128i) low, (__m128i) high));
+#else
+  const MinimumULanes kBits = { 1, 2, 4, 8, 16, 32, 64, 128 };
+  MinimumULanes bits = ((MinimumULanes) low & kBits) |
+      ((MinimumULanes) high & (kBits << 8));
+  return bits[0] | bits[1] | bits[2] | bits[3] | bits[4] | bits[5] | bits[6] |
+      bits[7];
+#endif
+}
+
+// Removes entry |position| of the aged window, moving the entries above down
+// and an empty one (10000 of age 101, aged) in at the end. The entry moved
+// into |position| is not aged, so it gets its age back.
+VAD_SP_INLINE void RemoveEntry(MinimumLanes* values_low,
+                               MinimumLanes* values_high,
+                               MinimumLanes* ages_low,
+                               MinimumLanes* ages_high,
+                               int16_t position) {
+  const MinimumLanes kEmptyValues = { 10000, 10000, 10000, 10000,
+                                      10000, 10000, 10000, 10000 };
+  const MinimumLanes kEmptyAges = { 102, 102, 102, 102, 102, 102, 102, 102 };
+  MinimumLanes above;
+  MinimumULanes at;
+
+  above = kLowLanes >= position;
+  at = (MinimumULanes) (kLowLanes == position);
+  *values_low = SELECT_LANES(above, SHIFT_DOWN(*values_low, *values_high),
+                             *values_low);
+  *ages_low = (MinimumLanes) ((MinimumULanes) SELECT_LANES(
+      above, SHIFT_DOWN(*ages_low, *ages_high), *ages_low) + at);
+
+  above = kHighLanes >= position;
+  at = (MinimumULanes) (kHighLanes == position);
+  *values_high = SELECT_LANES(above, SHIFT_DOWN(*values_high, kEmptyValues),
+                              *values_high);
+  *ages_high = (MinimumLanes) ((MinimumULanes) SELECT_LANES(
+      above, SHIFT_DOWN(*ages_high, kEmptyAges), *ages_high) + at);
+}
+
+// Inserts |value| at lane |position| of |low|:|high|, moving the lanes above
+// up and the last one out. Nothing changes if |position| is beyond the lanes.
+VAD_SP_INLINE void InsertLane(MinimumLanes* low, MinimumLanes* high,
+                              int16_t position, int16_t value) {
+  const MinimumLanes values = { value, value, value, value,
+                                value, value, value, value };
+  MinimumLanes low_up = SHIFT_UP(*low, *low);
+  MinimumLanes high_up = SHIFT_UP(*low, *high);
+
+  *low = SELECT_LANES(kLowLanes < position, *low,
+                      SELECT_LANES(kLowLanes == position, values, low_up));
+  *high = SELECT_LANES(kHighLanes < position, *high,
+                       SELECT_LANES(kHighLanes == position, values, high_up));
+}
+
+// Ages the 16 smallest values, removes the expired ones and inserts
+// |feature_value| if it is smaller than any of them.
+static void UpdateSmallestValues(int16_t* age, int16_t* smallest_values,
+                                 int16_t feature_value) {
+  MinimumLanes ages_low, ages_high, values_low, values_high;
+  int expired, removed, starts, even_runs, not_smaller, count;
+  int16_t position;
+
+  memcpy(&ages_low, &age[0], sizeof(ages_low));
+  memcpy(&ages_high, &age[8], sizeof(ages_high));
+  memcpy(&values_low, &smallest_values[0], sizeof(values_low));
+  memcpy(&values_high, &smallest_values[8], sizeof(values_high));
+
+  // A value of age 100 is removed, and the value shifted into its place is
+  // neither aged nor checked. Hence, of consecutive expired values, the first
+  // one and every second after it is removed.
+  expired = LanesToBits(ages_low == 100, ages_high == 100);
+  starts = expired & ~(expired << 1);
+  even_runs = expired & ~(expired + (starts & 0x5555));
+  removed = (even_runs & 0x5555) | (expired & ~even_runs & 0xAAAA);
+
+  ages_low = (MinimumLanes) ((MinimumULanes) ages_low + 1);
+  ages_high = (MinimumLanes) ((MinimumULanes) ages_high + 1);
+
+  // The first removal, if any, is done unconditionally. Position 16 leaves
+  // the window unchanged.
+  position = (int16_t) __builtin_ctz(removed | 0x10000);
+  RemoveEntry(&values_low, &values_high, &ages_low, &ages_high, position);
+  removed &= removed - 1;
+  for (count = 1; removed != 0; count++) {
+    position = (int16_t) (__builtin_ctz(removed) - count);
+    RemoveEntry(&values_low, &values_high, &ages_low, &ages_high, position);
+    removed &= removed - 1;
+  }
+
+  // Same |position| as the binary search of the scalar code, 16 or more if
+  // |feature_value| is not smaller than values 7 and 15.
+  not_smaller = LanesToBits(feature_value >= values_low,
+                            feature_value >= values_high);
+  position = ((not_smaller >> 7) & 1) << 3;
+  position += ((not_smaller >> (position + 3)) & 1) << 2;
+  position += ((not_smaller >> (position + 1)) & 1) << 1;
+  position += (not_smaller >> position) & 1;
+  position |= ((not_smaller >> 7) & (not_smaller >> 15) & 1) << 4;
+  InsertLane(&values_low, &values_high, position, feature_value);
+  InsertLane(&ages_low, &ages_high, position, 1);
+
+  memcpy(&age[0], &ages_low, sizeof(ages_low));
+  memcpy(&age[8], &ages_high, sizeof(ages_high));
+  memcpy(&smallest_values[0], &values_low, sizeof(values_low));
+  memcpy(&smallest_values[8], &values_high, sizeof(values_high));
+}
+#else
+// Ages the 16 smallest values, removes the expired ones and inserts
+// |feature_value| if it is smaller than any of them.
+static void UpdateSmallestValues(int16_t* age, int16_t* smallest_values,
+                                 int16_t feature_value) {
   int i = 0, j = 0;
   int position = -1;
-  // Offset to beginning of the 16 minimum values in memory.
-  const int offset = (channel << 4);
-  int16_t current_median = 1600;
-  int16_t alpha = 0;
-  int32_t tmp32 = 0;
-  // Pointer to memory for the 16 minimum values and the age of each value of
-  // the |channel|.
-  int16_t* age = &self->index_vector[offset];
-  int16_t* smallest_values = &self->low_value_vector[offset];
-
-  assert(channel < kNumChannels);
 
   // Each value in |smallest_values| is getting 1 loop older. Update |age|, and
   // remove old values.
@@ -153,6 +462,28 @@ int16_t WebRtcVad_FindMinimum(VadInstT* self,
     smallest_values[position] = feature_value;
     age[position] = 1;
   }
+}
+#endif  // VAD_SP_LANES
+
+// Inserts |feature_value| into |low_value_vector|, if it is one of the 16
+// smallest values the last 100 frames. Then calculates and returns the median
+// of the five smallest values.
+int16_t WebRtcVad_FindMinimum(VadInstT* self,
+                              int16_t feature_value,
+                              int channel) {
+  // Offset to beginning of the 16 minimum values in memory.
+  const int offset = (channel << 4);
+  int16_t current_median = 1600;
+  int16_t alpha = 0;
+  int32_t tmp32 = 0;
+  // Pointer to memory for the 16 minimum values and the age of each value of
+  // the |channel|.
+  int16_t* age = &self->index_vector[offset];
+  int16_t* smallest_values = &self->low_value_vector[offset];
+
+  assert(channel < kNumChannels);
+
+  UpdateSmallestValues(age, smallest_values, feature_value);
 
   // Get |current_median|.
   if (self->frame_counter > 2) {
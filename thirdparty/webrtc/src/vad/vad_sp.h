@@ -17,6 +17,15 @@
 #include "vad_core.h"
 #include "typedefs.h"
 
+// Work memory of WebRtcVad_Downsampling48khz(): 10 ms of 24 kHz samples and 8
+// samples of history of the 48 kHz resampler, 16-byte aligned.
+enum { kResampleScratchLength = 240 + 8 };
+#if defined(__GNUC__)
+#define VAD_SCRATCH_ALIGNED __attribute__((aligned(16)))
+#else
+#define VAD_SCRATCH_ALIGNED
+#endif
+
 // Downsamples the signal by a factor 2, eg. 32->16 or 16->8.
 //
 // Inputs:
@@ -35,6 +44,43 @@ void WebRtcVad_Downsampling(const int16_t* signal_in,
                             int32_t* filter_state,
                             size_t in_length);
 
+// Downsamples the signal by a factor 4, 32->8, in one pass. Same as
+// WebRtcVad_Downsampling() from 32 to 16 kHz with the filter states at
+// |filter_state| + 2, followed by 16 to 8 kHz with those at |filter_state|.
+//
+// Inputs:
+//      - signal_in     : Input signal.
+//      - in_length     : Length of input signal in samples.
+//
+// Input & Output:
+//      - filter_state  : Current filter states of the four all-pass filters.
+//
+// Output:
+//      - signal_out    : Downsampled signal (of length |in_length| / 4).
+void WebRtcVad_Downsampling32khz(const int16_t* signal_in,
+                                 int16_t* signal_out,
+                                 int32_t* filter_state,
+                                 size_t in_length);
+
+// Downsamples 10 ms of 48 kHz signal to 8 kHz. Gives the same output and
+// filter states as WebRtcSpl_Resample48khzTo8khz(), in two passes instead of
+// eight.
+//
+// Inputs:
+//      - signal_in     : Input signal, 480 samples.
+//
+// Input & Output:
+//      - state         : Filter states of the resampler.
+//
+// Output:
+//      - signal_out    : Downsampled signal, 80 samples.
+//      - scratch       : Work memory of |kResampleScratchLength| values, needs
+//                        no initialization.
+void WebRtcVad_Downsampling48khz(const int16_t* signal_in,
+                                 int16_t* signal_out,
+                                 WebRtcSpl_State48khzTo8khz* state,
+                                 int32_t* scratch);
+
 // Updates and returns the smoothed feature minimum. As minimum we use the
 // median of the five smallest feature values in a 100 frames long window.
 // As long as |handle->frame_counter| is zero, that is, we haven't received any
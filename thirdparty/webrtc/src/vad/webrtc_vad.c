@@ -10,6 +10,7 @@
 
 #include "vad/webrtc_vad.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -22,6 +23,43 @@ static const int kValidRates[] = { 8000, 16000, 32000, 48000 };
 static const size_t kRatesSize = sizeof(kValidRates) / sizeof(*kValidRates);
 static const int kMaxFrameLengthMs = 30;
 
+// Saved state: a version word, then these fields of VadInstT back to back in
+// host byte order. Bump kStateVersion whenever the list or a field changes.
+static const uint32_t kStateVersion = 1;
+
+#define STATE_FIELD(name) \
+  { offsetof(VadInstT, name), sizeof(((VadInstT*) 0)->name) }
+
+static const struct {
+  size_t offset;
+  size_t size;
+} kStateFields[] = {
+  STATE_FIELD(vad),
+  STATE_FIELD(downsampling_filter_states),
+  STATE_FIELD(state_48_to_8),
+  STATE_FIELD(noise_means),
+  STATE_FIELD(speech_means),
+  STATE_FIELD(noise_stds),
+  STATE_FIELD(speech_stds),
+  STATE_FIELD(frame_counter),
+  STATE_FIELD(over_hang),
+  STATE_FIELD(num_of_speech),
+  STATE_FIELD(index_vector),
+  STATE_FIELD(low_value_vector),
+  STATE_FIELD(mean_value),
+  STATE_FIELD(upper_state),
+  STATE_FIELD(lower_state),
+  STATE_FIELD(hp_filter_state),
+  STATE_FIELD(over_hang_max_1),
+  STATE_FIELD(over_hang_max_2),
+  STATE_FIELD(individual),
+  STATE_FIELD(total),
+  STATE_FIELD(log_likelihood_ratio),
+  STATE_FIELD(likelihood_threshold),
+};
+static const size_t kStateFieldsSize =
+    sizeof(kStateFields) / sizeof(*kStateFields);
+
 VadInst* WebRtcVad_Create() {
   VadInstT* self = (VadInstT*)malloc(sizeof(VadInstT));
 
@@ -90,6 +128,153 @@ int WebRtcVad_Process(VadInst* handle, int fs, const int16_t* audio_frame,
   return vad;
 }
 
+int WebRtcVad_ProcessBatch(VadInst* const* handles, int fs,
+                           const int16_t* const* audio_frames,
+                           size_t frame_length, int count, int* vads) {
+  int i, n;
+
+  if (handles == NULL || audio_frames == NULL || vads == NULL) {
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    if (handles[i] == NULL || audio_frames[i] == NULL) {
+      return -1;
+    }
+    if (((VadInstT*) handles[i])->init_flag != kInitCheck) {
+      return -1;
+    }
+  }
+  if (WebRtcVad_ValidRateAndFrameLength(fs, frame_length) != 0) {
+    return -1;
+  }
+
+  for (i = 0; i < count; i += n) {
+    n = count - i < kMaxBatchSize ? count - i : kMaxBatchSize;
+    WebRtcVad_CalcVadBatch((VadInstT* const*) &handles[i], fs, &audio_frames[i],
+                           frame_length, n, &vads[i]);
+  }
+  for (i = 0; i < count; i++) {
+    if (vads[i] > 0) {
+      vads[i] = 1;
+    }
+  }
+  return 0;
+}
+
+int WebRtcVad_GetLikelihood(VadInst* handle, int* log_likelihood_ratio,
+                            int* threshold) {
+  VadInstT* self = (VadInstT*) handle;
+
+  if (handle == NULL || log_likelihood_ratio == NULL || threshold == NULL) {
+    return -1;
+  }
+  if (self->init_flag != kInitCheck) {
+    return -1;
+  }
+
+  *log_likelihood_ratio = self->log_likelihood_ratio;
+  *threshold = self->likelihood_threshold;
+  return 0;
+}
+
+int WebRtcVad_GetNoiseProfile(VadInst* handle, WebRtcVadNoiseProfile* profile) {
+  VadInstT* self = (VadInstT*) handle;
+
+  if (handle == NULL || profile == NULL) {
+    return -1;
+  }
+  if (self->init_flag != kInitCheck) {
+    return -1;
+  }
+
+  memcpy(profile->noise_means, self->noise_means, sizeof(profile->noise_means));
+  memcpy(profile->noise_stds, self->noise_stds, sizeof(profile->noise_stds));
+  memcpy(profile->low_value_vector, self->low_value_vector,
+         sizeof(profile->low_value_vector));
+  memcpy(profile->mean_value, self->mean_value, sizeof(profile->mean_value));
+  return 0;
+}
+
+int WebRtcVad_SetNoiseProfile(VadInst* handle,
+                              const WebRtcVadNoiseProfile* profile) {
+  VadInstT* self = (VadInstT*) handle;
+
+  if (handle == NULL || profile == NULL) {
+    return -1;
+  }
+  if (self->init_flag != kInitCheck) {
+    return -1;
+  }
+
+  memcpy(self->noise_means, profile->noise_means, sizeof(self->noise_means));
+  memcpy(self->noise_stds, profile->noise_stds, sizeof(self->noise_stds));
+  memcpy(self->low_value_vector, profile->low_value_vector,
+         sizeof(self->low_value_vector));
+  memcpy(self->mean_value, profile->mean_value, sizeof(self->mean_value));
+  memset(self->index_vector, 0, sizeof(self->index_vector));
+  // WebRtcVad_FindMinimum() ignores the minimum values for the first frames.
+  if (self->frame_counter < 3) {
+    self->frame_counter = 3;
+  }
+  return 0;
+}
+
+size_t WebRtcVad_StateSize(void) {
+  size_t size = sizeof(kStateVersion);
+  size_t i;
+
+  for (i = 0; i < kStateFieldsSize; i++) {
+    size += kStateFields[i].size;
+  }
+  return size;
+}
+
+int WebRtcVad_SaveState(VadInst* handle, void* state, size_t size) {
+  VadInstT* self = (VadInstT*) handle;
+  uint8_t* dst = (uint8_t*) state;
+  size_t i;
+
+  if (handle == NULL || state == NULL || size < WebRtcVad_StateSize()) {
+    return -1;
+  }
+  if (self->init_flag != kInitCheck) {
+    return -1;
+  }
+
+  memcpy(dst, &kStateVersion, sizeof(kStateVersion));
+  dst += sizeof(kStateVersion);
+  for (i = 0; i < kStateFieldsSize; i++) {
+    memcpy(dst, (const uint8_t*) self + kStateFields[i].offset,
+           kStateFields[i].size);
+    dst += kStateFields[i].size;
+  }
+  return 0;
+}
+
+int WebRtcVad_RestoreState(VadInst* handle, const void* state, size_t size) {
+  VadInstT* self = (VadInstT*) handle;
+  const uint8_t* src = (const uint8_t*) state;
+  uint32_t version;
+  size_t i;
+
+  if (handle == NULL || state == NULL || size != WebRtcVad_StateSize()) {
+    return -1;
+  }
+  memcpy(&version, src, sizeof(version));
+  if (version != kStateVersion) {
+    return -1;
+  }
+
+  src += sizeof(version);
+  for (i = 0; i < kStateFieldsSize; i++) {
+    memcpy((uint8_t*) self + kStateFields[i].offset, src,
+           kStateFields[i].size);
+    src += kStateFields[i].size;
+  }
+  self->init_flag = kInitCheck;
+  return 0;
+}
+
 int WebRtcVad_ValidRateAndFrameLength(int rate, size_t frame_length) {
   int return_value = -1;
   size_t i;